@@ -0,0 +1,289 @@
+#ifndef __BENCH_HH__
+#define __BENCH_HH__
+
+#include <cstdio>
+#include <cstdint>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+
+struct BenchOptions {
+	std::vector<size_t> sizes = { 1000, 100000, 1000000 };
+	unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::string> filters;
+	// Where the results table goes, stderr when the JSON goes to stdout.
+	FILE *log = stdout;
+};
+
+struct BenchResult {
+	std::string container, op, keys;
+	size_t n;
+	unsigned threads;
+	size_t nOps;
+	double seconds;
+};
+
+class BenchSuite {
+private:
+	BenchOptions _options;
+	std::vector<BenchResult> _results;
+
+public:
+	/// @brief Checksums of the measured loops go here, so that the compiler
+	/// cannot drop them.
+	std::atomic<uint64_t> sink{ 0 };
+
+	inline BenchSuite(BenchOptions options) : _options(options) {}
+
+	inline const BenchOptions &options() const {
+		return _options;
+	}
+
+	/// @brief Thread counts to run multi-threaded cases with, 1, 2, 4, ...
+	/// up to the configured maximum.
+	inline std::vector<unsigned> threadCounts() const {
+		std::vector<unsigned> counts;
+		for (unsigned i = 1; i < _options.maxThreads; i <<= 1)
+			counts.push_back(i);
+		counts.push_back(_options.maxThreads);
+		return counts;
+	}
+
+	/// @brief Whether a container was selected by the --filter option.
+	inline bool enabled(const char *container) const {
+		if (_options.filters.empty())
+			return true;
+		for (auto &i : _options.filters) {
+			if (std::string(container).find(i) != std::string::npos)
+				return true;
+		}
+		return false;
+	}
+
+	void record(const char *container, const char *op, const char *keys, size_t n, unsigned threads, size_t nOps, double seconds);
+	void writeJson(FILE *fp) const;
+};
+
+/// @brief Keys 0..n-1, in order or shuffled.
+std::vector<int> makeKeys(size_t n, bool shuffled, uint64_t seed = 1);
+
+template <typename F>
+inline double timeIt(F &&f) {
+	auto begin = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+/// @brief Run f(threadIndex) on `nThreads` threads which are released at
+/// the same time.
+/// @return Wall time from the release until the last thread finished.
+template <typename F>
+inline double timeThreads(unsigned nThreads, F &&f) {
+	std::atomic<unsigned> nReady{ 0 };
+	std::atomic<bool> go{ false };
+	std::vector<std::thread> threads;
+
+	for (unsigned i = 0; i < nThreads; ++i) {
+		threads.emplace_back([&, i]() {
+			++nReady;
+			while (!go.load(std::memory_order_acquire))
+				std::this_thread::yield();
+			f(i);
+		});
+	}
+
+	while (nReady.load() != nThreads)
+		std::this_thread::yield();
+
+	auto begin = std::chrono::steady_clock::now();
+	go.store(true, std::memory_order_release);
+	for (auto &i : threads)
+		i.join();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+/// @brief Run insert, find, iterate and erase over sequential and random
+/// keys on an associative container, wrapped by an adapter with:
+///
+///   constexpr static bool CAN_ITERATE, CAN_ERASE, CONCURRENT_WRITES;
+///   void insert(int key);          // value = key
+///   long find(int key);            // value of a present key
+///   long iterate();                // sum of all values
+///   void erase(int key);
+///
+/// Lookups are repeated for every thread count. With CONCURRENT_WRITES the
+/// lookups are measured once more while a writer thread inserts and erases
+/// keys outside of the looked up range.
+template <typename C>
+inline void benchAssociative(BenchSuite &suite, const char *name) {
+	if (!suite.enabled(name))
+		return;
+
+	for (size_t n : suite.options().sizes) {
+		std::vector<int> lookups = makeKeys(n, true, 2);
+
+		for (bool shuffled : { false, true }) {
+			const char *keysName = shuffled ? "random" : "sequential";
+			std::vector<int> keys = makeKeys(n, shuffled);
+			auto c = std::make_unique<C>();
+
+			suite.record(name, "insert", keysName, n, 1, n, timeIt([&]() {
+				for (int i : keys)
+					c->insert(i);
+			}));
+
+			auto find = [&](unsigned) {
+				uint64_t sum = 0;
+				for (int i : lookups)
+					sum += c->find(i);
+				suite.sink += sum;
+			};
+
+			for (unsigned nThreads : suite.threadCounts())
+				suite.record(name, "find", keysName, n, nThreads, n * nThreads, timeThreads(nThreads, find));
+
+			if constexpr (C::CONCURRENT_WRITES) {
+				for (unsigned nThreads : suite.threadCounts()) {
+					std::atomic<bool> stop{ false };
+					std::thread writer([&]() {
+						for (int i = (int)n; !stop.load(std::memory_order_relaxed); ++i) {
+							c->insert(i);
+							c->erase(i);
+							// Leave the readers a chance on machines with few cores.
+							std::this_thread::yield();
+						}
+					});
+					double seconds = timeThreads(nThreads, find);
+					stop = true;
+					writer.join();
+					suite.record(name, "find+writer", keysName, n, nThreads, n * nThreads, seconds);
+				}
+			}
+
+			if constexpr (C::CAN_ITERATE) {
+				suite.record(name, "iterate", keysName, n, 1, n, timeIt([&]() {
+					suite.sink += c->iterate();
+				}));
+			}
+
+			if constexpr (C::CAN_ERASE) {
+				suite.record(name, "erase", keysName, n, 1, n, timeIt([&]() {
+					for (int i : keys)
+						c->erase(i);
+				}));
+			}
+		}
+	}
+}
+
+/// @brief Single-threaded lookups of random keys, which are present, for
+/// comparing the variants of a container such as its lock policies. The
+/// adapter needs insert() and find() as for benchAssociative().
+template <typename C>
+inline void benchLookup(BenchSuite &suite, const char *name) {
+	if (!suite.enabled(name))
+		return;
+
+	for (size_t n : suite.options().sizes) {
+		std::vector<int> lookups = makeKeys(n, true, 2);
+		auto c = std::make_unique<C>();
+		for (int i : makeKeys(n, true))
+			c->insert(i);
+
+		suite.record(name, "find", "random", n, 1, n, timeIt([&]() {
+			uint64_t sum = 0;
+			for (int i : lookups)
+				sum += c->find(i);
+			suite.sink += sum;
+		}));
+	}
+}
+
+/// @brief Keys per call in benchBatchLookup().
+constexpr size_t LOOKUP_BATCH = 256;
+
+/// @brief Random lookups of present keys, one at a time and in batches of
+/// LOOKUP_BATCH keys, for containers with batched lookups. The difference
+/// is the memory-level parallelism gained by interleaving the lookups, so
+/// it shows with sizes beyond the caches. The adapter needs insert() and
+/// find() as for benchAssociative(), and:
+///
+///   long findBatch(const int *keys, size_t n);  // sum of the values
+template <typename C>
+inline void benchBatchLookup(BenchSuite &suite, const char *name) {
+	if (!suite.enabled(name))
+		return;
+
+	for (size_t n : suite.options().sizes) {
+		std::vector<int> lookups = makeKeys(n, true, 2);
+		auto c = std::make_unique<C>();
+		for (int i : makeKeys(n, true))
+			c->insert(i);
+
+		suite.record(name, "find loop", "random", n, 1, n, timeIt([&]() {
+			uint64_t sum = 0;
+			for (int i : lookups)
+				sum += c->find(i);
+			suite.sink += sum;
+		}));
+
+		suite.record(name, "findBatch", "random", n, 1, n, timeIt([&]() {
+			uint64_t sum = 0;
+			for (size_t i = 0; i < n; i += LOOKUP_BATCH)
+				sum += c->findBatch(lookups.data() + i, std::min(n - i, LOOKUP_BATCH));
+			suite.sink += sum;
+		}));
+	}
+}
+
+/// @brief Mixed load of 80% lookups, 10% upserts and 10% erasures on random
+/// keys, half of which are present, for every thread count. The adapter
+/// needs:
+///
+///   void upsert(int key);
+///   bool tryErase(int key);
+///   bool contains(int key);
+template <typename C>
+inline void benchMixed(BenchSuite &suite, const char *name) {
+	if (!suite.enabled(name))
+		return;
+
+	for (size_t n : suite.options().sizes) {
+		for (unsigned nThreads : suite.threadCounts()) {
+			auto c = std::make_unique<C>();
+			for (int i : makeKeys(n, true)) {
+				if (i & 1)
+					c->upsert(i);
+			}
+
+			suite.record(name, "mixed", "random", n, nThreads, n * nThreads, timeThreads(nThreads, [&](unsigned thread) {
+				uint64_t x = 0x9e3779b97f4a7c15ull * (thread + 1), sum = 0;
+				for (size_t i = 0; i < n; ++i) {
+					x ^= x << 13;
+					x ^= x >> 7;
+					x ^= x << 17;
+					int key = (int)((x >> 8) % n);
+					unsigned op = (unsigned)(x & 0xff) % 10;
+					if (op == 0)
+						c->upsert(key);
+					else if (op == 1)
+						sum += c->tryErase(key);
+					else
+						sum += c->contains(key);
+				}
+				suite.sink += sum;
+			}));
+		}
+	}
+}
+
+void benchOrdered(BenchSuite &suite);
+void benchHash(BenchSuite &suite);
+void benchSequence(BenchSuite &suite);
+
+#endif
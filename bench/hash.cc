@@ -0,0 +1,139 @@
+#include <unordered_map>
+#include "bench.hh"
+#include "../map/hashmap.hh"
+#include "../map/concurrenthashmap.hh"
+#include "../map/rwlock.h"
+#include "../map/mutex.h"
+#include "../map/spinlock.h"
+
+template <typename L = NullLock>
+struct HashMapBench {
+	constexpr static bool CAN_ITERATE = true, CAN_ERASE = true, CONCURRENT_WRITES = false;
+	HashMap<int, int, std::hash<int>, L> map;
+
+	inline void insert(int key) { map.insert(key, key); }
+	inline long find(int key) { return map.find(key)->value; }
+	inline void erase(int key) { map.remove(key); }
+
+	inline long findBatch(const int *keys, size_t n) {
+		assert(n <= LOOKUP_BATCH);
+		n = std::min(n, LOOKUP_BATCH);
+		int *values[LOOKUP_BATCH];
+		map.findBatch(keys, n, values);
+		long sum = 0;
+		for (size_t i = 0; i < n; ++i)
+			sum += *values[i];
+		return sum;
+	}
+
+	inline long iterate() {
+		long sum = 0;
+		for (auto i = map.begin(); i != map.end(); ++i)
+			sum += i->value;
+		return sum;
+	}
+};
+
+struct StdUnorderedMapBench {
+	constexpr static bool CAN_ITERATE = true, CAN_ERASE = true, CONCURRENT_WRITES = false;
+	std::unordered_map<int, int> map;
+
+	inline void insert(int key) { map.emplace(key, key); }
+	inline long find(int key) { return map.find(key)->second; }
+	inline void erase(int key) { map.erase(key); }
+
+	inline long iterate() {
+		long sum = 0;
+		for (auto &i : map)
+			sum += i.second;
+		return sum;
+	}
+};
+
+struct ConcurrentHashMapBench {
+	constexpr static bool CAN_ITERATE = true, CAN_ERASE = true, CONCURRENT_WRITES = true;
+	ConcurrentHashMap<int, int> map;
+
+	inline void insert(int key) { map.insert(key, key); }
+	inline long find(int key) { return map.get(key); }
+	inline void erase(int key) { map.remove(key); }
+
+	inline void upsert(int key) { map.upsert(key, [](int &value) { ++value; }); }
+	inline bool tryErase(int key) { return map.erase(key); }
+	inline bool contains(int key) { return map.contains(key); }
+
+	inline long iterate() {
+		long sum = 0;
+		map.forEach([&](const int &, const int &value) { sum += value; });
+		return sum;
+	}
+};
+
+/// @brief std::unordered_map behind one RWLock, the baseline for
+/// ConcurrentHashMap under mixed loads.
+struct LockedUnorderedMapBench {
+	std::unordered_map<int, int> map;
+	RWLock lock;
+
+	inline void upsert(int key) {
+		LockGuard<RWLock> lg(lock);
+		++map[key];
+	}
+
+	inline bool tryErase(int key) {
+		LockGuard<RWLock> lg(lock);
+		return map.erase(key);
+	}
+
+	inline bool contains(int key) {
+		SharedLockGuard<RWLock> lg(lock);
+		return map.count(key);
+	}
+};
+
+/// @brief Latency of single insertions while a container grows from empty
+/// to n entries, where rehashing shows up as outliers. The percentiles are
+/// recorded as one operation taking that long.
+template <typename C>
+static void benchGrowthLatency(BenchSuite &suite, const char *name) {
+	if (!suite.enabled(name))
+		return;
+
+	for (size_t n : suite.options().sizes) {
+		std::vector<int> keys = makeKeys(n, true);
+		std::vector<double> latencies(n);
+		auto c = std::make_unique<C>();
+
+		double seconds = 0;
+		for (size_t i = 0; i < n; ++i) {
+			auto begin = std::chrono::steady_clock::now();
+			c->insert(keys[i]);
+			latencies[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+			seconds += latencies[i];
+		}
+		suite.record(name, "grow", "random", n, 1, n, seconds);
+
+		std::sort(latencies.begin(), latencies.end());
+		suite.record(name, "grow p99.9", "random", n, 1, 1, latencies[n - 1 - n / 1000]);
+		suite.record(name, "grow max", "random", n, 1, 1, latencies[n - 1]);
+	}
+}
+
+void benchHash(BenchSuite &suite) {
+	benchAssociative<HashMapBench<>>(suite, "HashMap");
+	benchAssociative<StdUnorderedMapBench>(suite, "std::unordered_map");
+	benchAssociative<ConcurrentHashMapBench>(suite, "ConcurrentHashMap");
+
+	benchMixed<ConcurrentHashMapBench>(suite, "ConcurrentHashMap");
+	benchMixed<LockedUnorderedMapBench>(suite, "std::unordered_map<RWLock>");
+
+	benchGrowthLatency<HashMapBench<>>(suite, "HashMap");
+	benchGrowthLatency<StdUnorderedMapBench>(suite, "std::unordered_map");
+
+	benchBatchLookup<HashMapBench<>>(suite, "HashMap");
+
+	benchLookup<HashMapBench<NullLock>>(suite, "HashMap<NullLock>");
+	benchLookup<HashMapBench<SpinLock>>(suite, "HashMap<SpinLock>");
+	benchLookup<HashMapBench<Mutex>>(suite, "HashMap<Mutex>");
+	benchLookup<HashMapBench<RWLock>>(suite, "HashMap<RWLock>");
+}
@@ -0,0 +1,106 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <algorithm>
+#include "bench.hh"
+
+void BenchSuite::record(const char *container, const char *op, const char *keys, size_t n, unsigned threads, size_t nOps, double seconds) {
+	_results.push_back({ container, op, keys, n, threads, nOps, seconds });
+	fprintf(_options.log, "%-16s %-12s %-10s n = %-10zu threads = %-3u %10.2f ns/op %10.2f Mops/s\n",
+		container, op, keys, n, threads, seconds * 1e9 / nOps, nOps / seconds / 1e6);
+	fflush(_options.log);
+}
+
+void BenchSuite::writeJson(FILE *fp) const {
+	fprintf(fp, "{\n\t\"benchmarks\": [");
+	for (size_t i = 0; i < _results.size(); ++i) {
+		const BenchResult &r = _results[i];
+		fprintf(fp,
+			"%s\n\t\t{ \"container\": \"%s\", \"op\": \"%s\", \"keys\": \"%s\", \"n\": %zu, \"threads\": %u, "
+			"\"ops\": %zu, \"seconds\": %.9f, \"ns_per_op\": %.3f, \"mops_per_sec\": %.3f }",
+			i ? "," : "", r.container.c_str(), r.op.c_str(), r.keys.c_str(), r.n, r.threads,
+			r.nOps, r.seconds, r.seconds * 1e9 / r.nOps, r.nOps / r.seconds / 1e6);
+	}
+	fprintf(fp, "\n\t]\n}\n");
+}
+
+std::vector<int> makeKeys(size_t n, bool shuffled, uint64_t seed) {
+	std::vector<int> keys(n);
+	for (size_t i = 0; i < n; ++i)
+		keys[i] = (int)i;
+	if (shuffled)
+		std::shuffle(keys.begin(), keys.end(), std::mt19937_64(seed));
+	return keys;
+}
+
+static std::vector<std::string> split(const char *s) {
+	std::vector<std::string> parts;
+	std::string part;
+	for (; *s; ++s) {
+		if (*s == ',') {
+			parts.push_back(part);
+			part.clear();
+		} else
+			part += *s;
+	}
+	if (!part.empty())
+		parts.push_back(part);
+	return parts;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr,
+		"Usage: %s [--sizes=1e3,1e5,1e6] [--threads=N] [--filter=Map,HashMap,...] [--json=FILE]\n"
+		"  --sizes    Element counts to run every case with.\n"
+		"  --threads  Maximum number of threads for multi-threaded cases.\n"
+		"  --filter   Only run containers whose name contains one of the strings.\n"
+		"  --json     Write all results as JSON to FILE ('-' for stdout, the table\n"
+		"             then goes to stderr).\n",
+		name);
+}
+
+int main(int argc, char **argv) {
+	BenchOptions options;
+	const char *jsonPath = nullptr;
+
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		if (!strncmp(arg, "--sizes=", 8)) {
+			options.sizes.clear();
+			for (auto &j : split(arg + 8))
+				options.sizes.push_back((size_t)strtod(j.c_str(), nullptr));
+		} else if (!strncmp(arg, "--threads=", 10)) {
+			options.maxThreads = std::max(1, atoi(arg + 10));
+		} else if (!strncmp(arg, "--filter=", 9)) {
+			options.filters = split(arg + 9);
+		} else if (!strncmp(arg, "--json=", 7)) {
+			jsonPath = arg + 7;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (jsonPath && !strcmp(jsonPath, "-"))
+		options.log = stderr;
+	BenchSuite suite(options);
+
+	benchOrdered(suite);
+	benchHash(suite);
+	benchSequence(suite);
+
+	if (jsonPath) {
+		FILE *fp = strcmp(jsonPath, "-") ? fopen(jsonPath, "w") : stdout;
+		if (!fp) {
+			perror(jsonPath);
+			return 1;
+		}
+		suite.writeJson(fp);
+		if (fp != stdout)
+			fclose(fp);
+	}
+
+	fprintf(options.log, "checksum = %llu\n", (unsigned long long)suite.sink.load());
+	return 0;
+}
@@ -0,0 +1,530 @@
+#include <map>
+#include <queue>
+#include <cstring>
+#include "bench.hh"
+#include "../map/map.hh"
+#include "../map/btree.hh"
+#include "../map/skiplist.hh"
+#include "../map/shardedmap.hh"
+#include "../map/persistenttree.h"
+#include "../map/set.hh"
+#include "../map/mutex.h"
+#include "../map/spinlock.h"
+#include "../tree/tree.h"
+
+struct RBTreeBench {
+	constexpr static bool CAN_ITERATE = true, CAN_ERASE = true, CONCURRENT_WRITES = true;
+	RBTree<int> tree;
+
+	inline void insert(int key) { tree.insert(key); }
+	inline long find(int key) { return tree.get(key)->value; }
+	inline void erase(int key) { tree.remove(key); }
+
+	inline long findBatch(const int *keys, size_t n) {
+		assert(n <= LOOKUP_BATCH);
+		n = std::min(n, LOOKUP_BATCH);
+		RBTree<int>::Node *nodes[LOOKUP_BATCH];
+		tree.findBatch(keys, n, nodes);
+		long sum = 0;
+		for (size_t i = 0; i < n; ++i)
+			sum += nodes[i]->value;
+		return sum;
+	}
+
+	inline long iterate() {
+		long sum = 0;
+		for (auto i = tree.begin(); i != tree.end(); ++i)
+			sum += *i;
+		return sum;
+	}
+};
+
+template <typename L = RWLock>
+struct MapBench {
+	constexpr static bool CAN_ITERATE = true, CAN_ERASE = true, CONCURRENT_WRITES = !std::is_same_v<L, NullLock>;
+	Map<int, int, PoolAllocator, false, L> map;
+
+	inline void insert(int key) { map.insert(key, key); }
+	inline long find(int key) { return map.get(key); }
+	inline void erase(int key) { map.remove(key); }
+
+	inline long findBatch(const int *keys, size_t n) {
+		assert(n <= LOOKUP_BATCH);
+		n = std::min(n, LOOKUP_BATCH);
+		int *values[LOOKUP_BATCH];
+		map.findBatch(keys, n, values);
+		long sum = 0;
+		for (size_t i = 0; i < n; ++i)
+			sum += *values[i];
+		return sum;
+	}
+
+	inline void upsert(int key) { map.insertOrAssign(key, key); }
+	inline bool tryErase(int key) { return map.erase(key); }
+	inline bool contains(int key) { return map.contains(key); }
+
+	inline long iterate() {
+		long sum = 0;
+		for (auto i = map.begin(); i != map.end(); ++i)
+			sum += i->value;
+		return sum;
+	}
+};
+
+struct BTreeMapBench {
+	constexpr static bool CAN_ITERATE = true, CAN_ERASE = true, CONCURRENT_WRITES = true;
+	BTreeMap<int, int> map;
+
+	inline void insert(int key) { map.insert(key, key); }
+	inline long find(int key) { return map.get(key); }
+	inline void erase(int key) { map.remove(key); }
+
+	inline void upsert(int key) { map.insert(key, key); }
+	inline bool contains(int key) { return map.has(key); }
+
+	inline bool tryErase(int key) {
+		try {
+			map.remove(key);
+			return true;
+		} catch (std::invalid_argument &) {
+			return false;
+		}
+	}
+
+	inline long iterate() {
+		long sum = 0;
+		for (auto i = map.begin(); i != map.end(); ++i)
+			sum += i->value;
+		return sum;
+	}
+};
+
+struct ShardedMapBench {
+	constexpr static bool CAN_ITERATE = true, CAN_ERASE = true, CONCURRENT_WRITES = true;
+	ShardedMap<int, int> map;
+
+	inline void insert(int key) { map.insert(key, key); }
+	inline long find(int key) { return map.get(key); }
+	inline void erase(int key) { map.remove(key); }
+
+	inline void upsert(int key) { map.insertOrAssign(key, key); }
+	inline bool tryErase(int key) { return map.erase(key); }
+	inline bool contains(int key) { return map.contains(key); }
+
+	inline long iterate() {
+		long sum = 0;
+		for (auto i = map.begin(); i != map.end(); ++i)
+			sum += i->value;
+		return sum;
+	}
+};
+
+struct SkipListMapBench {
+	constexpr static bool CAN_ITERATE = true, CAN_ERASE = true, CONCURRENT_WRITES = true;
+	SkipListMap<int, int> map;
+
+	inline void insert(int key) { map.insert(key, key); }
+	inline long find(int key) { return map.get(key); }
+	inline void erase(int key) { map.remove(key); }
+
+	inline void upsert(int key) { map.insert(key, key); }
+	inline bool tryErase(int key) { return map.erase(key); }
+	inline bool contains(int key) { return map.contains(key); }
+
+	inline long iterate() {
+		long sum = 0;
+		for (auto i = map.begin(); i != map.end(); ++i)
+			sum += i->value;
+		return sum;
+	}
+};
+
+struct PersistentRBTreeBench {
+	constexpr static bool CAN_ITERATE = true, CAN_ERASE = true, CONCURRENT_WRITES = true;
+	PersistentRBTree<int> tree;
+
+	inline void insert(int key) { tree.insert(key); }
+	inline long find(int key) { return tree.get(key); }
+	inline void erase(int key) { tree.remove(key); }
+
+	inline void upsert(int key) { tree.insertOrAssign(key); }
+	inline bool tryErase(int key) { return tree.erase(key); }
+	inline bool contains(int key) { return tree.has(key); }
+
+	inline long iterate() {
+		long sum = 0;
+		auto snapshot = tree.snapshot();
+		for (int i : snapshot)
+			sum += i;
+		return sum;
+	}
+};
+
+// Set has no iterator and its remove() is known to be broken.
+struct SetBench {
+	constexpr static bool CAN_ITERATE = false, CAN_ERASE = false, CONCURRENT_WRITES = false;
+	Set<int, int> set;
+
+	inline void insert(int key) { set[key] = key; }
+	inline long find(int key) { return set.get(key); }
+	inline void erase(int) {}
+	inline long iterate() { return 0; }
+};
+
+struct StdMapBench {
+	constexpr static bool CAN_ITERATE = true, CAN_ERASE = true, CONCURRENT_WRITES = false;
+	std::map<int, int> map;
+
+	inline void insert(int key) { map.emplace(key, key); }
+	inline long find(int key) { return map.find(key)->second; }
+	inline void erase(int key) { map.erase(key); }
+
+	inline long iterate() {
+		long sum = 0;
+		for (auto &i : map)
+			sum += i.second;
+		return sum;
+	}
+};
+
+struct KfRbtreeBench {
+	constexpr static bool CAN_ITERATE = true, CAN_ERASE = true, CONCURRENT_WRITES = false;
+
+	struct Node {
+		kf_rbtree_node_t node;
+		int key;
+	};
+
+	kf_rbtree_t tree;
+	kf_rbtree_slab_t slab;
+
+	static int nodeCmp(const kf_rbtree_node_t *x, const kf_rbtree_node_t *y) {
+		int a = ((const Node *)x)->key, b = ((const Node *)y)->key;
+		return (a > b) - (a < b);
+	}
+
+	static int keyCmp(const kf_rbtree_node_t *x, const void *key) {
+		int a = ((const Node *)x)->key, b = (int)(intptr_t)key;
+		return (a > b) - (a < b);
+	}
+
+	inline KfRbtreeBench() {
+		kf_rbtree_init(&tree, nodeCmp, keyCmp, nullptr, nullptr);
+		kf_rbtree_slab_init(&slab, sizeof(Node), 0);
+		kf_rbtree_use_slab(&tree, &slab);
+	}
+
+	inline ~KfRbtreeBench() {
+		kf_rbtree_free(&tree);
+	}
+
+	inline void insert(int key) {
+		Node *node = (Node *)kf_rbtree_slab_alloc(&slab);
+		memset(node, 0, sizeof(*node));
+		node->key = key;
+		kf_rbtree_insert(&tree, &node->node);
+	}
+
+	inline long find(int key) {
+		return ((Node *)kf_rbtree_find(&tree, (const void *)(intptr_t)key))->key;
+	}
+
+	inline void erase(int key) {
+		kf_rbtree_remove(&tree, kf_rbtree_find(&tree, (const void *)(intptr_t)key));
+	}
+
+	inline long findBatch(const int *keys, size_t n) {
+		assert(n <= LOOKUP_BATCH);
+		n = std::min(n, LOOKUP_BATCH);
+		const void *ptrs[LOOKUP_BATCH] = {};
+		kf_rbtree_node_t *nodes[LOOKUP_BATCH];
+		for (size_t i = 0; i < n; ++i)
+			ptrs[i] = (const void *)(intptr_t)keys[i];
+		kf_rbtree_find_batch(&tree, ptrs, n, nodes);
+		long sum = 0;
+		for (size_t i = 0; i < n; ++i)
+			sum += ((Node *)nodes[i])->key;
+		return sum;
+	}
+
+	inline long iterate() {
+		long sum = 0;
+		for (kf_rbtree_node_t *i = kf_rbtree_begin(&tree); i; i = kf_rbtree_next(i))
+			sum += ((Node *)i)->key;
+		return sum;
+	}
+};
+
+/// @brief Full in-order scans of a kf_rbtree which was built from random
+/// keys, through parent pointers (kf_rbtree_next/prev) and through an
+/// explicit stack (kf_rbtree_iter_*, kf_rbtree_foreach). Pass sizes in the
+/// millions to see the effect of cache misses.
+static void benchKfRbtreeScan(BenchSuite &suite) {
+	if (!suite.enabled("kf_rbtree"))
+		return;
+
+	using Node = KfRbtreeBench::Node;
+	for (size_t n : suite.options().sizes) {
+		KfRbtreeBench c;
+		for (int i : makeKeys(n, true))
+			c.insert(i);
+
+		suite.record("kf_rbtree", "scan next", "random", n, 1, n, timeIt([&]() {
+			uint64_t sum = 0;
+			for (kf_rbtree_node_t *i = kf_rbtree_begin(&c.tree); i; i = kf_rbtree_next(i))
+				sum += ((Node *)i)->key;
+			suite.sink += sum;
+		}));
+
+		suite.record("kf_rbtree", "scan prev", "random", n, 1, n, timeIt([&]() {
+			uint64_t sum = 0;
+			for (kf_rbtree_node_t *i = kf_rbtree_rbegin(&c.tree); i; i = kf_rbtree_prev(i))
+				sum += ((Node *)i)->key;
+			suite.sink += sum;
+		}));
+
+		suite.record("kf_rbtree", "scan iter", "random", n, 1, n, timeIt([&]() {
+			uint64_t sum = 0;
+			kf_rbtree_iter_t it;
+			for (kf_rbtree_node_t *i = kf_rbtree_iter_begin(&it, &c.tree); i; i = kf_rbtree_iter_next(&it))
+				sum += ((Node *)i)->key;
+			suite.sink += sum;
+		}));
+
+		suite.record("kf_rbtree", "scan foreach", "random", n, 1, n, timeIt([&]() {
+			uint64_t sum = 0;
+			kf_rbtree_foreach(
+				&c.tree, [](kf_rbtree_node_t *node, void *arg) {
+					*(uint64_t *)arg += ((Node *)node)->key;
+					return 0;
+				},
+				&sum);
+			suite.sink += sum;
+		}));
+	}
+}
+
+/// @brief Writers and a thread which keeps scanning the whole container at
+/// the same time: a Map has to be held for a scan, a PersistentRBTree is
+/// scanned through a snapshot. Records the erase+upsert throughput of the
+/// writer and the number of entries the scanner got through meanwhile.
+static void benchScanWhileWriting(BenchSuite &suite) {
+	for (size_t n : suite.options().sizes) {
+		std::vector<int> keys = makeKeys(n, true);
+
+		auto run = [&](const char *name, auto &c, auto &&scan) {
+			for (int i : keys)
+				c.upsert(i);
+
+			std::atomic<bool> stop{ false };
+			size_t nScans = 0;
+			std::thread scanner([&]() {
+				while (!stop.load(std::memory_order_relaxed)) {
+					suite.sink += scan();
+					++nScans;
+					std::this_thread::yield();
+				}
+			});
+			double seconds = timeIt([&]() {
+				for (int i : keys) {
+					c.tryErase(i);
+					c.upsert(i);
+				}
+			});
+			stop = true;
+			scanner.join();
+			suite.record(name, "write+scanner", "random", n, 1, 2 * n, seconds);
+			suite.record(name, "scan+writer", "random", n, 1, nScans * n, seconds);
+		};
+
+		if (suite.enabled("Map")) {
+			MapBench<> c;
+			run("Map", c, [&]() {
+				c.map.lockShared();
+				long sum = c.iterate();
+				c.map.unlockShared();
+				return sum;
+			});
+		}
+
+		if (suite.enabled("PersistentRBTree")) {
+			PersistentRBTreeBench c;
+			run("PersistentRBTree", c, [&]() {
+				return c.iterate();
+			});
+		}
+	}
+}
+
+/// @brief Loading a Map from sorted pairs, as from a snapshot, compared to
+/// inserting them one by one.
+static void benchMapBulkLoad(BenchSuite &suite) {
+	if (!suite.enabled("Map"))
+		return;
+
+	for (size_t n : suite.options().sizes) {
+		std::vector<std::pair<int, int>> pairs(n);
+		for (size_t i = 0; i < n; ++i)
+			pairs[i] = { (int)i, (int)i };
+
+		{
+			Map<int, int> map;
+			suite.record("Map", "assignSorted", "sequential", n, 1, n, timeIt([&]() {
+				map.assignSorted(pairs.begin(), pairs.end());
+			}));
+		}
+
+		std::vector<int> keys = makeKeys(n, true);
+		for (size_t i = 0; i < n; ++i)
+			pairs[i] = { keys[i], keys[i] };
+
+		{
+			Map<int, int> map;
+			suite.record("Map", "assign", "random", n, 1, n, timeIt([&]() {
+				map.assign(pairs.begin(), pairs.end());
+			}));
+		}
+	}
+}
+
+/// @brief Warm restarts: saving a Map as an image and serving it through
+/// MappedMap, against re-inserting every entry of the image into a Map.
+static void benchMapImage(BenchSuite &suite) {
+	if (!suite.enabled("Map") && !suite.enabled("MappedMap"))
+		return;
+
+	std::string path = std::string(P_tmpdir) + "/bench-map.img";
+	for (size_t n : suite.options().sizes) {
+		std::vector<int> lookups = makeKeys(n, true, 2);
+		{
+			Map<int, int> map;
+			for (int i : makeKeys(n, true))
+				map.insert(i, i);
+			suite.record("Map", "save", "random", n, 1, n, timeIt([&]() {
+				map.save(path.c_str());
+			}));
+		}
+
+		std::unique_ptr<MappedMap<int, int>> mapped;
+		suite.record("MappedMap", "open", "random", n, 1, 1, timeIt([&]() {
+			mapped = std::make_unique<MappedMap<int, int>>(Map<int, int>::openMapped(path.c_str()));
+		}));
+
+		suite.record("MappedMap", "find", "random", n, 1, n, timeIt([&]() {
+			uint64_t sum = 0;
+			for (int i : lookups)
+				sum += mapped->get(i);
+			suite.sink += sum;
+		}));
+
+		suite.record("MappedMap", "iterate", "random", n, 1, n, timeIt([&]() {
+			uint64_t sum = 0;
+			for (auto i = mapped->begin(); i != mapped->end(); ++i)
+				sum += i->value;
+			suite.sink += sum;
+		}));
+
+		Map<int, int> map;
+		suite.record("Map", "reload", "random", n, 1, n, timeIt([&]() {
+			for (auto i = mapped->begin(); i != mapped->end(); ++i)
+				map.insert(i->key, i->value);
+		}));
+	}
+	std::remove(path.c_str());
+}
+
+/// @brief Overwriting the values of existing keys, against std::map.
+static void benchUpsert(BenchSuite &suite) {
+	for (size_t n : suite.options().sizes) {
+		std::vector<int> keys = makeKeys(n, true);
+
+		if (suite.enabled("Map")) {
+			Map<int, int> map;
+			for (int i : keys)
+				map.insert(i, i);
+			suite.record("Map", "upsert", "random", n, 1, n, timeIt([&]() {
+				for (int i : keys)
+					map.insertOrAssign(i, i + 1);
+			}));
+		}
+
+		if (suite.enabled("std::map")) {
+			std::map<int, int> map;
+			for (int i : keys)
+				map.emplace(i, i);
+			suite.record("std::map", "upsert", "random", n, 1, n, timeIt([&]() {
+				for (int i : keys)
+					map.insert_or_assign(i, i + 1);
+			}));
+		}
+	}
+}
+
+/// @brief RBTree as a priority queue: push random keys, then pop them all
+/// in ascending order, against std::priority_queue.
+static void benchPriorityQueue(BenchSuite &suite) {
+	for (size_t n : suite.options().sizes) {
+		std::vector<int> keys = makeKeys(n, true);
+
+		if (suite.enabled("RBTree")) {
+			RBTree<int, PoolAllocator, false, NullLock> tree;
+			suite.record("RBTree", "push+popFront", "random", n, 1, 2 * n, timeIt([&]() {
+				for (int i : keys)
+					tree.insert(i);
+				uint64_t sum = 0;
+				while (tree.size())
+					sum += tree.popFront();
+				suite.sink += sum;
+			}));
+		}
+
+		if (suite.enabled("std::priority_queue")) {
+			std::priority_queue<int, std::vector<int>, std::greater<int>> queue;
+			suite.record("std::priority_queue", "push+pop", "random", n, 1, 2 * n, timeIt([&]() {
+				for (int i : keys)
+					queue.push(i);
+				uint64_t sum = 0;
+				while (!queue.empty()) {
+					sum += queue.top();
+					queue.pop();
+				}
+				suite.sink += sum;
+			}));
+		}
+	}
+}
+
+void benchOrdered(BenchSuite &suite) {
+	benchAssociative<RBTreeBench>(suite, "RBTree");
+	benchAssociative<MapBench<>>(suite, "Map");
+	benchMapBulkLoad(suite);
+	benchMapImage(suite);
+	benchAssociative<BTreeMapBench>(suite, "BTreeMap");
+	benchAssociative<SkipListMapBench>(suite, "SkipListMap");
+	benchAssociative<ShardedMapBench>(suite, "ShardedMap");
+	benchAssociative<PersistentRBTreeBench>(suite, "PersistentRBTree");
+	benchAssociative<SetBench>(suite, "Set");
+	benchAssociative<KfRbtreeBench>(suite, "kf_rbtree");
+	benchKfRbtreeScan(suite);
+	benchAssociative<StdMapBench>(suite, "std::map");
+	benchUpsert(suite);
+	benchPriorityQueue(suite);
+
+	// The hot lookup path under each lock policy, the differences are the
+	// cost of an uncontended lock.
+	benchLookup<MapBench<NullLock>>(suite, "Map<NullLock>");
+	benchLookup<MapBench<SpinLock>>(suite, "Map<SpinLock>");
+	benchLookup<MapBench<Mutex>>(suite, "Map<Mutex>");
+	benchLookup<MapBench<RWLock>>(suite, "Map<RWLock>");
+
+	benchBatchLookup<RBTreeBench>(suite, "RBTree");
+	benchBatchLookup<MapBench<NullLock>>(suite, "Map<NullLock>");
+	benchBatchLookup<KfRbtreeBench>(suite, "kf_rbtree");
+
+	benchMixed<MapBench<>>(suite, "Map");
+	benchMixed<BTreeMapBench>(suite, "BTreeMap");
+	benchMixed<SkipListMapBench>(suite, "SkipListMap");
+	benchMixed<ShardedMapBench>(suite, "ShardedMap");
+	benchMixed<PersistentRBTreeBench>(suite, "PersistentRBTree");
+	benchScanWhileWriting(suite);
+}
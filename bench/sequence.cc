@@ -0,0 +1,96 @@
+#include <vector>
+#include "bench.hh"
+#include "../list/list.hh"
+#include "../list/dynarray.hh"
+
+struct DynArrayBench {
+	constexpr static bool CAN_INDEX = true;
+	DynArray<int> array;
+
+	inline void append(int value) { array.pushBack(value); }
+	inline long index(size_t i) { return array.at(i); }
+	inline void pop() { array.popBack(); }
+
+	inline long iterate() {
+		long sum = 0;
+		for (auto i = array.begin(); i != array.end(); ++i)
+			sum += *i;
+		return sum;
+	}
+};
+
+// Indexing a linked list is O(n), which is not worth measuring.
+struct ListBench {
+	constexpr static bool CAN_INDEX = false;
+	List<int> list;
+
+	inline void append(int value) { list.prepend(list.end(), value); }
+	inline long index(size_t i) { return list.at(i); }
+	inline void pop() { list.remove(--list.end()); }
+
+	inline long iterate() {
+		long sum = 0;
+		for (auto i = list.begin(); i != list.end(); ++i)
+			sum += *i;
+		return sum;
+	}
+};
+
+struct StdVectorBench {
+	constexpr static bool CAN_INDEX = true;
+	std::vector<int> vector;
+
+	inline void append(int value) { vector.push_back(value); }
+	inline long index(size_t i) { return vector[i]; }
+	inline void pop() { vector.pop_back(); }
+
+	inline long iterate() {
+		long sum = 0;
+		for (int i : vector)
+			sum += i;
+		return sum;
+	}
+};
+
+/// @brief Append, random indexing, iteration and popping from the back.
+template <typename C>
+static void benchSequence(BenchSuite &suite, const char *name) {
+	if (!suite.enabled(name))
+		return;
+
+	for (size_t n : suite.options().sizes) {
+		auto c = std::make_unique<C>();
+
+		suite.record(name, "append", "sequential", n, 1, n, timeIt([&]() {
+			for (size_t i = 0; i < n; ++i)
+				c->append((int)i);
+		}));
+
+		if constexpr (C::CAN_INDEX) {
+			std::vector<int> indices = makeKeys(n, true, 2);
+			for (unsigned nThreads : suite.threadCounts()) {
+				suite.record(name, "index", "random", n, nThreads, n * nThreads, timeThreads(nThreads, [&](unsigned) {
+					uint64_t sum = 0;
+					for (int i : indices)
+						sum += c->index(i);
+					suite.sink += sum;
+				}));
+			}
+		}
+
+		suite.record(name, "iterate", "sequential", n, 1, n, timeIt([&]() {
+			suite.sink += c->iterate();
+		}));
+
+		suite.record(name, "pop", "sequential", n, 1, n, timeIt([&]() {
+			for (size_t i = 0; i < n; ++i)
+				c->pop();
+		}));
+	}
+}
+
+void benchSequence(BenchSuite &suite) {
+	benchSequence<DynArrayBench>(suite, "DynArray");
+	benchSequence<ListBench>(suite, "List");
+	benchSequence<StdVectorBench>(suite, "std::vector");
+}
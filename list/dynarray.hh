@@ -2,11 +2,15 @@
 #define __DYNARRAY_HH__
 
 #include <cstdint>
+#include <cstring>
 #include <algorithm>
 #include <cassert>
 #include <stdexcept>
 #include <string>
 #include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 template <typename T>
 class DynArray {
@@ -15,23 +19,15 @@ public:
 		size_t index;
 		DynArray *array;
 
-		inline Iterator(const Iterator &it) : index(it.index) {}
-		inline Iterator(const Iterator &&it) : index(it.index) {}
-		inline Iterator(size_t index) : index(index) {}
+		inline Iterator(const Iterator &it) = default;
+		inline Iterator(size_t index, DynArray *array) : index(index), array(array) {}
 
-		inline Iterator &operator=(const Iterator &rhs) noexcept {
-			index.rhs = index;
-			return *this;
-		}
-
-		inline Iterator &operator=(const Iterator &&rhs) noexcept {
-			index.rhs = index;
-			return *this;
-		}
+		inline Iterator &operator=(const Iterator &rhs) noexcept = default;
 
 		inline Iterator &operator++() {
-			if ((index++) > array->_len)
+			if (index >= array->_len)
 				throw std::logic_error("Increasing the end iterator");
+			++index;
 			return *this;
 		}
 
@@ -42,8 +38,9 @@ public:
 		}
 
 		inline Iterator &operator--() {
-			if (!(index--))
+			if (!index)
 				throw std::logic_error("Dereasing the begin iterator");
+			--index;
 			return *this;
 		}
 
@@ -61,11 +58,6 @@ public:
 			return index == it.index;
 		}
 
-		inline bool operator==(const Iterator &&rhs) const {
-			const Iterator it = rhs;
-			return *this == it;
-		}
-
 		inline bool operator!=(const size_t index) const noexcept {
 			return this->index != index;
 		}
@@ -74,11 +66,6 @@ public:
 			return index != it.index;
 		}
 
-		inline bool operator!=(Iterator &&rhs) const {
-			Iterator it = rhs;
-			return *this != it;
-		}
-
 		inline T &operator*() {
 			if (index >= array->_len)
 				throw std::logic_error("Deferencing the end iterator");
@@ -104,109 +91,107 @@ public:
 		}
 	};
 
-	template <bool doAppend>
-	inline size_t _insert(size_t begin, size_t size) {
-		if constexpr (doAppend) {
-			assert(begin < _len);
-		}
+	constexpr static bool TRIVIAL = std::is_trivially_copyable<T>::value;
 
-		size_t newSize = _len + size;
+	static inline T *_allocate(size_t capacity) {
+		return (T *)::operator new(capacity * sizeof(T), std::align_val_t(alignof(T)));
+	}
+
+	static inline void _deallocate(T *elements) {
+		::operator delete(elements, std::align_val_t(alignof(T)));
+	}
+
+	/// @brief Move `n` elements from `src` to uninitialized storage at `dest`,
+	/// leaving `src` uninitialized. The ranges may overlap.
+	static inline void _relocate(T *dest, T *src, size_t n) {
+		if (!n || dest == src)
+			return;
 
-		std::unique_ptr<T[]> newElements(new T[newSize]);
-
-		if (_elements) {
-			size_t idxLatterElements;
-			if constexpr (doAppend)
-				idxLatterElements = begin + size + 1;
-			else
-				idxLatterElements = begin + size;
-
-			if constexpr (std::is_literal_type<T>::value) {
-				if constexpr (doAppend) {
-					// Copy former elements.
-					memcpy(newElements.get(), _elements, (begin + 1) * sizeof(T));
-					// Copy latter elements.
-					if (idxLatterElements < newSize)
-						memcpy(newElements.get() + idxLatterElements, newSize - idxLatterElements);
-
-					// `begin' will be used as the result.
-					++begin;
-				} else {
-					// Copy former elements.
-					if (begin)
-						memcpy(newElements.get(), _elements, (begin) * sizeof(T));
-					// Copy latter elements.
-					memcpy(newElements.get() + idxLatterElements, _elements + begin, newSize - idxLatterElements);
+		if constexpr (TRIVIAL) {
+			memmove(dest, src, n * sizeof(T));
+		} else {
+			if (dest < src) {
+				for (size_t i = 0; i < n; ++i) {
+					new (dest + i) T(std::move(src[i]));
+					src[i].~T();
 				}
 			} else {
-				if constexpr (doAppend) {
-					// Copy former elements.
-					for (size_t i = 0; i < begin; ++i)
-						newElements.get()[i] = std::move(_elements[i]);
-					// Copy latter elements.
-					for (size_t i = idxLatterElements; i < newSize; ++i)
-						newElements.get()[i] = std::move(_elements[i]);
-
-					// `begin' will be used as the result.
-					++begin;
-				} else {
-					// Copy former elements.
-					for (size_t i = 0; i < begin; ++i)
-						newElements.get()[i] = std::move(_elements[i]);
-					// Copy latter elements.
-					for (size_t i = idxLatterElements; i < newSize; ++i)
-						newElements.get()[i] = std::move(_elements[i]);
+				for (size_t i = n; i--;) {
+					new (dest + i) T(std::move(src[i]));
+					src[i].~T();
 				}
 			}
+		}
+	}
 
-			delete _elements;
+	static inline void _destroy(T *elements, size_t n) {
+		if constexpr (!std::is_trivially_destructible<T>::value) {
+			for (size_t i = 0; i < n; ++i)
+				elements[i].~T();
 		}
-		_elements = newElements.release();
+	}
+
+	inline void _reallocate(size_t newCapacity) {
+		assert(newCapacity >= _len);
+
+		T *newElements = newCapacity ? _allocate(newCapacity) : nullptr;
+		_relocate(newElements, _elements, _len);
+		if (_elements)
+			_deallocate(_elements);
+		_elements = newElements;
+		_capacity = newCapacity;
+	}
+
+	/// @brief Open a gap of `size` uninitialized elements at `begin`.
+	/// @return Index of the first element of the gap.
+	inline size_t _insert(size_t begin, size_t size) {
+		assert(begin <= _len);
+
+		size_t newSize = _len + size;
+
+		if (newSize > _capacity) {
+			// Grow geometrically so that appending is amortized O(1), and
+			// move each element only once while making room for the gap.
+			size_t newCapacity = std::max(std::max(_capacity * 2, newSize), (size_t)4);
+			T *newElements = _allocate(newCapacity);
+
+			_relocate(newElements, _elements, begin);
+			_relocate(newElements + begin + size, _elements + begin, _len - begin);
+
+			if (_elements)
+				_deallocate(_elements);
+			_elements = newElements;
+			_capacity = newCapacity;
+		} else
+			_relocate(_elements + begin + size, _elements + begin, _len - begin);
+
 		_len = newSize;
 
 		return begin;
 	}
 
+	/// @brief Move `data` into the gap of one element at `index` which was
+	/// opened by _insert(), closing the gap again if the move throws.
+	inline void _fill(size_t index, T &&data) {
+		try {
+			new (_elements + index) T(std::move(data));
+		} catch (...) {
+			_relocate(_elements + index, _elements + index + 1, _len - index - 1);
+			--_len;
+			throw;
+		}
+	}
+
 	/// @brief Remove elements from range [begin, end)
 	/// @param begin Index of the first element to be removed.
 	/// @param end Next index of the last element to be removed.
 	inline void _remove(size_t begin, size_t end) {
-		assert(begin < end);
-		assert(begin < _len);
-		assert(end < _len);
-
-		size_t newSize = _len - begin - end;
-		if (!newSize) {
-			delete _elements;
-			_elements = nullptr;
-		} else {
-			std::unique_ptr<T[]> newElements(new T[newSize]);
-
-			if (begin) {
-				if constexpr (std::is_literal_type<T>::value) {
-					memcpy(newElements.get(), _elements, begin * sizeof(T));
-				} else {
-					for (size_t i = 0; i < begin; ++i)
-						newElements.get()[i] = std::move(_elements[i]);
-				}
-			}
+		assert(begin <= end);
+		assert(end <= _len);
 
-			if (end < _len) {
-				if constexpr (std::is_literal_type<T>::value) {
-					memcpy(newElements.get() + begin, _elements + end, _len - end);
-				} else {
-					const size_t nElementsToCopy = _len - end;
-					for (size_t i = 0; i < nElementsToCopy; ++i) {
-						newElements[begin + i] = std::move(_elements[end + i]);
-					}
-				}
-			}
-
-			if (_elements)
-				delete _elements;
-			_elements = newElements.release();
-		}
-		_len = newSize;
+		_destroy(_elements + begin, end - begin);
+		_relocate(_elements + begin, _elements + end, _len - end);
+		_len -= end - begin;
 	}
 
 	inline void _remove(size_t where) {
@@ -214,36 +199,108 @@ public:
 	}
 
 protected:
-	size_t _len = 0;
+	size_t _len = 0, _capacity = 0;
 	T *_elements = nullptr;
 
 public:
 	inline DynArray() {
 	}
 
+	inline DynArray(const DynArray &other) {
+		reserve(other._len);
+		size_t i = 0;
+		try {
+			for (; i < other._len; ++i)
+				new (_elements + i) T(other._elements[i]);
+		} catch (...) {
+			// The destructor does not run for a constructor which throws.
+			_destroy(_elements, i);
+			if (_elements)
+				_deallocate(_elements);
+			throw;
+		}
+		_len = other._len;
+	}
+
+	inline DynArray(DynArray &&other) noexcept
+		: _len(other._len), _capacity(other._capacity), _elements(other._elements) {
+		other._len = 0, other._capacity = 0, other._elements = nullptr;
+	}
+
+	inline DynArray &operator=(DynArray rhs) noexcept {
+		std::swap(_len, rhs._len);
+		std::swap(_capacity, rhs._capacity);
+		std::swap(_elements, rhs._elements);
+		return *this;
+	}
+
 	inline ~DynArray() {
+		_destroy(_elements, _len);
 		if (_elements)
-			delete[] _elements;
+			_deallocate(_elements);
 	}
 
 	inline Iterator begin() {
-		return Iterator(0);
+		return Iterator(0, this);
 	}
 	inline Iterator end() {
-		return Iterator(_len);
+		return Iterator(_len, this);
 	}
 
+	/// @brief Insert an element before `where`.
 	inline Iterator prepend(Iterator where, T data) {
-		auto index = _insert<false>(where.index, 1);
-		_elements[index] = data;
+		auto index = _insert(where.index, 1);
+		_fill(index, std::move(data));
 
-		return Iterator(index);
+		return Iterator(index, this);
 	}
+	/// @brief Insert an element after `where`.
 	inline Iterator append(Iterator where, T data) {
-		auto node = _insert<true>(where.index, 1);
-		node->v = data;
+		if (where.index >= _len)
+			throw std::logic_error("Appending after the end iterator");
+
+		auto index = _insert(where.index + 1, 1);
+		_fill(index, std::move(data));
+
+		return Iterator(index, this);
+	}
+
+	template <typename... Args>
+	inline T &emplaceBack(Args &&...args) {
+		T *element;
+
+		if (_len == _capacity) {
+			// Construct the new element before the old ones move, since the
+			// arguments may refer to an element of this array.
+			size_t newCapacity = std::max(_capacity * 2, (size_t)4);
+			T *newElements = _allocate(newCapacity);
+			try {
+				element = new (newElements + _len) T(std::forward<Args>(args)...);
+			} catch (...) {
+				_deallocate(newElements);
+				throw;
+			}
+
+			_relocate(newElements, _elements, _len);
+			if (_elements)
+				_deallocate(_elements);
+			_elements = newElements;
+			_capacity = newCapacity;
+		} else
+			element = new (_elements + _len) T(std::forward<Args>(args)...);
+
+		++_len;
+		return *element;
+	}
 
-		return Iterator(node);
+	inline void pushBack(T data) {
+		emplaceBack(std::move(data));
+	}
+
+	inline void popBack() {
+		if (!_len)
+			throw std::logic_error("Popping from an empty array");
+		_remove(_len - 1);
 	}
 
 	inline void remove(Iterator where) {
@@ -268,6 +325,16 @@ public:
 		return _elements[i];
 	}
 
+	inline T &operator[](size_t i) {
+		assert(i < _len);
+		return _elements[i];
+	}
+
+	inline const T &operator[](size_t i) const {
+		assert(i < _len);
+		return _elements[i];
+	}
+
 	inline T get(size_t i) {
 		return at(i);
 	}
@@ -276,14 +343,39 @@ public:
 		return at(i);
 	}
 
+	inline T *data() {
+		return _elements;
+	}
+
+	inline const T *data() const {
+		return _elements;
+	}
+
+	/// @brief Make room for at least `capacity` elements without reallocating.
+	inline void reserve(size_t capacity) {
+		if (capacity > _capacity)
+			_reallocate(capacity);
+	}
+
+	/// @brief Release the capacity which is not used by any element.
+	inline void shrinkToFit() {
+		if (_capacity > _len)
+			_reallocate(_len);
+	}
+
+	/// @brief Destroy all elements, the capacity is kept.
 	inline void clear() {
-		delete[] _elements;
-		_elements = nullptr;
+		_destroy(_elements, _len);
+		_len = 0;
 	}
 
 	inline size_t size() const {
 		return _len;
 	}
+
+	inline size_t capacity() const {
+		return _capacity;
+	}
 };
 
 #endif
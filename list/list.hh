@@ -5,8 +5,9 @@
 #include <algorithm>
 #include <cassert>
 #include <stdexcept>
+#include "../map/pool.h"
 
-template <typename T>
+template <typename T, typename A = PoolAllocator>
 class List {
 public:
 	struct Node {
@@ -109,7 +110,7 @@ public:
 	};
 
 	inline Node *_prepend(Node *where) {
-		auto node = new Node(where->pre, where);
+		auto node = A::template create<Node>(where->pre, where);
 		if (where->pre)
 			where->pre->next = node;
 		where->pre = node;
@@ -124,7 +125,7 @@ public:
 	inline Node *_append(Node *where) {
 		assert(where != _end);
 
-		auto node = new Node(where, where->next);
+		auto node = A::template create<Node>(where, where->next);
 		if (where->next)
 			where->next->pre = node;
 		where->next = node;
@@ -139,7 +140,9 @@ public:
 			where->next->pre = where->pre;
 		if (where->pre)
 			where->pre->next = where->next;
-		delete where;
+		A::destroy(where);
+
+		--_curSize;
 	}
 
 protected:
@@ -147,8 +150,8 @@ protected:
 	size_t _curSize;
 
 public:
-	inline List(size_t size = 0) : _curSize(size) {
-		_head = new Node(), _end = new Node();
+	inline List(size_t size = 0) : _curSize(0) {
+		_head = A::template create<Node>(), _end = A::template create<Node>();
 		_head->next = _end, _end->pre = _head;
 
 		while (size--) {
@@ -157,16 +160,15 @@ public:
 	}
 
 	inline ~List() {
-		for (Node *i = _head; i != _end;) {
+		for (Node *i = _head; i;) {
 			auto next = i->next;
-			remove(i);
+			A::destroy(i);
 			i = next;
 		}
-		delete _end;
 	}
 
 	inline Iterator begin() {
-		return Iterator(_head);
+		return Iterator(_head->next);
 	}
 	inline Iterator end() {
 		return Iterator(_end);
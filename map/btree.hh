@@ -0,0 +1,576 @@
+#ifndef __BTREE_H__
+#define __BTREE_H__
+
+#include <cstdint>
+#include <cassert>
+#include <stdexcept>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include "rwlock.h"
+#include "lockguard.h"
+#include "pool.h"
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+#elif defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
+
+/// @brief Ordered map as a B+-tree, with the same interface as Map.
+///
+/// Keys of a node are stored contiguously and span a few cache lines, so a
+/// lookup touches a handful of nodes instead of one node per level. Keys of
+/// 32-bit and 64-bit integers are searched with SSE2/AVX2 when the target
+/// enables them. All entries live in the leaves, which are linked for
+/// in-order iteration. K and V must be default constructible.
+template <typename K, typename V, typename A = PoolAllocator>
+class BTreeMap final {
+public:
+	/// @brief Up to about 512 bytes of keys and values per leaf, and of keys
+	/// and child pointers per inner node.
+	constexpr static unsigned LEAF_SIZE = std::clamp<size_t>(512 / (sizeof(K) + sizeof(V)), 8, 64),
+							  INNER_SIZE = std::clamp<size_t>(512 / (sizeof(K) + sizeof(void *)), 8, 64);
+
+private:
+	// Splitting a full node leaves both halves at least at these sizes.
+	constexpr static unsigned LEAF_MIN = LEAF_SIZE / 2, INNER_MIN = (INNER_SIZE - 1) / 2;
+
+	struct Node {
+		bool isLeaf;
+		unsigned n = 0;
+
+		inline Node(bool isLeaf) : isLeaf(isLeaf) {}
+	};
+
+	struct Leaf : Node {
+		Leaf *prev = nullptr, *next = nullptr;
+		K keys[LEAF_SIZE];
+		V values[LEAF_SIZE];
+
+		inline Leaf() : Node(true) {}
+	};
+
+	struct Inner : Node {
+		K keys[INNER_SIZE];
+		Node *children[INNER_SIZE + 1];
+
+		inline Inner() : Node(false) {}
+	};
+
+	RWLock _lock;
+	Node *_root = nullptr;
+	Leaf *_first = nullptr, *_last = nullptr;
+	size_t _size = 0;
+
+	/// @brief Number of keys before `key` in a sorted array, i.e. the index
+	/// of the first key which is not less than (UPPER: greater than) `key`.
+	template <bool UPPER>
+	static inline unsigned _rank(const K *keys, unsigned n, const K &key) {
+		unsigned i = 0;
+#if defined(__SSE2__)
+		if constexpr (std::is_integral_v<K> && std::is_signed_v<K> && sizeof(K) == 4) {
+	#if defined(__AVX2__)
+			const __m256i k = _mm256_set1_epi32((int32_t)key);
+			for (; i + 8 <= n; i += 8) {
+				__m256i x = _mm256_loadu_si256((const __m256i *)(keys + i));
+				// Bits of the keys which are before `key`, a prefix since keys are sorted.
+				unsigned mask = UPPER ? ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, k))) & 0xff
+									  : _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, x)));
+				if (mask != 0xff)
+					return i + __builtin_popcount(mask);
+			}
+	#else
+			const __m128i k = _mm_set1_epi32((int32_t)key);
+			for (; i + 4 <= n; i += 4) {
+				__m128i x = _mm_loadu_si128((const __m128i *)(keys + i));
+				unsigned mask = UPPER ? ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(x, k))) & 0xf
+									  : _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, x)));
+				if (mask != 0xf)
+					return i + __builtin_popcount(mask);
+			}
+	#endif
+			for (; i < n && (UPPER ? !(key < keys[i]) : keys[i] < key); ++i)
+				;
+			return i;
+		}
+	#if defined(__AVX2__)
+		if constexpr (std::is_integral_v<K> && std::is_signed_v<K> && sizeof(K) == 8) {
+			const __m256i k = _mm256_set1_epi64x((int64_t)key);
+			for (; i + 4 <= n; i += 4) {
+				__m256i x = _mm256_loadu_si256((const __m256i *)(keys + i));
+				unsigned mask = UPPER ? ~_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x, k))) & 0xf
+									  : _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(k, x)));
+				if (mask != 0xf)
+					return i + __builtin_popcount(mask);
+			}
+			for (; i < n && (UPPER ? !(key < keys[i]) : keys[i] < key); ++i)
+				;
+			return i;
+		}
+	#endif
+#endif
+		if constexpr (UPPER)
+			return (unsigned)(std::upper_bound(keys, keys + n, key) - keys);
+		else
+			return (unsigned)(std::lower_bound(keys, keys + n, key) - keys);
+	}
+
+	/// @brief Child of an inner node whose subtree may contain `key`.
+	static inline unsigned _route(const Inner *node, const K &key) {
+		return _rank<true>(node->keys, node->n, key);
+	}
+
+	inline std::pair<Leaf *, unsigned> _get(const K &key) const {
+		Node *node = _root;
+		if (!node)
+			return { nullptr, 0 };
+
+		while (!node->isLeaf) {
+			Inner *inner = (Inner *)node;
+			node = inner->children[_route(inner, key)];
+		}
+
+		Leaf *leaf = (Leaf *)node;
+		unsigned i = _rank<false>(leaf->keys, leaf->n, key);
+		if (i == leaf->n || key < leaf->keys[i])
+			return { nullptr, 0 };
+		return { leaf, i };
+	}
+
+	static inline void _destroy(Node *node) {
+		if (node->isLeaf) {
+			A::destroy((Leaf *)node);
+			return;
+		}
+
+		Inner *inner = (Inner *)node;
+		for (unsigned i = 0; i <= inner->n; ++i)
+			_destroy(inner->children[i]);
+		A::destroy(inner);
+	}
+
+	template <typename T>
+	static inline void _insertAt(T *array, unsigned n, unsigned i, T value) {
+		std::move_backward(array + i, array + n, array + n + 1);
+		array[i] = std::move(value);
+	}
+
+	template <typename T>
+	static inline void _removeAt(T *array, unsigned n, unsigned i) {
+		std::move(array + i + 1, array + n, array + i);
+	}
+
+	/// @brief Move the upper half of a full leaf into a new right sibling.
+	inline Leaf *_splitLeaf(Leaf *leaf) {
+		Leaf *right = A::template create<Leaf>();
+		unsigned mid = LEAF_SIZE / 2;
+
+		std::move(leaf->keys + mid, leaf->keys + LEAF_SIZE, right->keys);
+		std::move(leaf->values + mid, leaf->values + LEAF_SIZE, right->values);
+		right->n = LEAF_SIZE - mid;
+		leaf->n = mid;
+
+		right->prev = leaf;
+		right->next = leaf->next;
+		if (leaf->next)
+			leaf->next->prev = right;
+		else
+			_last = right;
+		leaf->next = right;
+		return right;
+	}
+
+	/// @brief Move the upper half of a full inner node into a new right
+	/// sibling, the middle key moves up into `splitKey`.
+	inline Inner *_splitInner(Inner *inner, K &splitKey) {
+		Inner *right = A::template create<Inner>();
+		unsigned mid = INNER_SIZE / 2;
+
+		splitKey = std::move(inner->keys[mid]);
+		std::move(inner->keys + mid + 1, inner->keys + INNER_SIZE, right->keys);
+		std::copy(inner->children + mid + 1, inner->children + INNER_SIZE + 1, right->children);
+		right->n = INNER_SIZE - mid - 1;
+		inner->n = mid;
+		return right;
+	}
+
+	/// @brief Insert or overwrite an entry in a subtree. A node which had to
+	/// be split returns its new right sibling in `split`, which has to be
+	/// linked into the parent with the separator `splitKey`.
+	/// @return Whether a new entry was inserted.
+	inline bool _insert(Node *node, const K &key, const V &value, K &splitKey, Node *&split) {
+		split = nullptr;
+
+		if (node->isLeaf) {
+			Leaf *leaf = (Leaf *)node;
+			unsigned i = _rank<false>(leaf->keys, leaf->n, key);
+			if (i < leaf->n && !(key < leaf->keys[i])) {
+				leaf->values[i] = value;
+				return false;
+			}
+
+			if (leaf->n == LEAF_SIZE) {
+				Leaf *right = _splitLeaf(leaf);
+				if (i > leaf->n) {
+					i -= leaf->n;
+					leaf = right;
+				}
+				split = right;
+			}
+
+			_insertAt(leaf->keys, leaf->n, i, key);
+			_insertAt(leaf->values, leaf->n, i, value);
+			++leaf->n;
+
+			if (split)
+				splitKey = ((Leaf *)split)->keys[0];
+			return true;
+		}
+
+		Inner *inner = (Inner *)node;
+		unsigned i = _route(inner, key);
+		K childKey;
+		Node *child;
+		bool inserted = _insert(inner->children[i], key, value, childKey, child);
+		if (!child)
+			return inserted;
+
+		if (inner->n == INNER_SIZE) {
+			Inner *right = _splitInner(inner, splitKey);
+			if (i > inner->n) {
+				i -= inner->n + 1;
+				inner = right;
+			}
+			split = right;
+		}
+
+		_insertAt(inner->keys, inner->n, i, std::move(childKey));
+		_insertAt(inner->children, inner->n + 1, i + 1, child);
+		++inner->n;
+		return inserted;
+	}
+
+	/// @brief Refill the child `i` of an inner node after it fell below the
+	/// minimum size, by borrowing from or merging with a sibling.
+	inline void _rebalance(Inner *parent, unsigned i) {
+		Node *node = parent->children[i];
+		Node *left = i ? parent->children[i - 1] : nullptr;
+		Node *right = i < parent->n ? parent->children[i + 1] : nullptr;
+		unsigned min = node->isLeaf ? LEAF_MIN : INNER_MIN;
+
+		if (node->isLeaf) {
+			Leaf *leaf = (Leaf *)node, *l = (Leaf *)left, *r = (Leaf *)right;
+
+			if (l && l->n > min) {
+				_insertAt(leaf->keys, leaf->n, 0, std::move(l->keys[l->n - 1]));
+				_insertAt(leaf->values, leaf->n, 0, std::move(l->values[l->n - 1]));
+				++leaf->n, --l->n;
+				parent->keys[i - 1] = leaf->keys[0];
+			} else if (r && r->n > min) {
+				leaf->keys[leaf->n] = std::move(r->keys[0]);
+				leaf->values[leaf->n] = std::move(r->values[0]);
+				_removeAt(r->keys, r->n, 0);
+				_removeAt(r->values, r->n, 0);
+				++leaf->n, --r->n;
+				parent->keys[i] = r->keys[0];
+			} else {
+				// Merge the right one of the two leaves into the left one.
+				if (!l) {
+					l = leaf;
+					++i;
+				} else
+					r = leaf;
+
+				std::move(r->keys, r->keys + r->n, l->keys + l->n);
+				std::move(r->values, r->values + r->n, l->values + l->n);
+				l->n += r->n;
+
+				l->next = r->next;
+				if (r->next)
+					r->next->prev = l;
+				else
+					_last = l;
+
+				_removeAt(parent->keys, parent->n, i - 1);
+				_removeAt(parent->children, parent->n + 1, i);
+				--parent->n;
+				A::destroy(r);
+			}
+			return;
+		}
+
+		Inner *inner = (Inner *)node, *l = (Inner *)left, *r = (Inner *)right;
+
+		if (l && l->n > min) {
+			_insertAt(inner->keys, inner->n, 0, std::move(parent->keys[i - 1]));
+			_insertAt(inner->children, inner->n + 1, 0, l->children[l->n]);
+			parent->keys[i - 1] = std::move(l->keys[l->n - 1]);
+			++inner->n, --l->n;
+		} else if (r && r->n > min) {
+			inner->keys[inner->n] = std::move(parent->keys[i]);
+			inner->children[inner->n + 1] = r->children[0];
+			parent->keys[i] = std::move(r->keys[0]);
+			_removeAt(r->keys, r->n, 0);
+			_removeAt(r->children, r->n + 1, 0);
+			++inner->n, --r->n;
+		} else {
+			if (!l) {
+				l = inner;
+				++i;
+			} else
+				r = inner;
+
+			l->keys[l->n] = std::move(parent->keys[i - 1]);
+			std::move(r->keys, r->keys + r->n, l->keys + l->n + 1);
+			std::copy(r->children, r->children + r->n + 1, l->children + l->n + 1);
+			l->n += r->n + 1;
+
+			_removeAt(parent->keys, parent->n, i - 1);
+			_removeAt(parent->children, parent->n + 1, i);
+			--parent->n;
+			A::destroy(r);
+		}
+	}
+
+	/// @return Whether the key was found.
+	inline bool _remove(Node *node, const K &key) {
+		if (node->isLeaf) {
+			Leaf *leaf = (Leaf *)node;
+			unsigned i = _rank<false>(leaf->keys, leaf->n, key);
+			if (i == leaf->n || key < leaf->keys[i])
+				return false;
+
+			_removeAt(leaf->keys, leaf->n, i);
+			_removeAt(leaf->values, leaf->n, i);
+			--leaf->n;
+			return true;
+		}
+
+		Inner *inner = (Inner *)node;
+		unsigned i = _route(inner, key);
+		Node *child = inner->children[i];
+		if (!_remove(child, key))
+			return false;
+
+		if (child->n < (child->isLeaf ? LEAF_MIN : INNER_MIN))
+			_rebalance(inner, i);
+		return true;
+	}
+
+	/// @return Depth of the leaves.
+	inline size_t _verify(Node *node, const K *lower, const K *upper, bool isRoot) const {
+		if (!isRoot && node->n < (node->isLeaf ? LEAF_MIN : INNER_MIN))
+			throw std::logic_error("Underfull node detected");
+
+		const K *keys = node->isLeaf ? ((Leaf *)node)->keys : ((Inner *)node)->keys;
+		for (unsigned i = 0; i < node->n; ++i) {
+			if ((i && !(keys[i - 1] < keys[i])) || (lower && keys[i] < *lower) || (upper && !(keys[i] < *upper)))
+				throw std::logic_error("Misordered keys detected");
+		}
+
+		if (node->isLeaf)
+			return 0;
+
+		Inner *inner = (Inner *)node;
+		size_t depth = 0;
+		for (unsigned i = 0; i <= inner->n; ++i) {
+			size_t d = _verify(inner->children[i], i ? &keys[i - 1] : lower, i < inner->n ? &keys[i] : upper, false);
+			if (i && d != depth)
+				throw std::logic_error("Inequal leaf depths detected");
+			depth = d;
+		}
+		return depth + 1;
+	}
+
+public:
+	/// @brief Reference to an entry, leaves keep keys and values apart.
+	struct Entry {
+		const K &key;
+		V &value;
+	};
+
+	struct Iterator {
+		Leaf *leaf;
+		unsigned index;
+		BTreeMap *tree;
+
+		inline Iterator(Leaf *leaf, unsigned index, BTreeMap *tree) : leaf(leaf), index(index), tree(tree) {}
+
+		inline Iterator &operator++() {
+			if (!leaf)
+				throw std::logic_error("Increasing the end iterator");
+
+			if (++index == leaf->n) {
+				leaf = leaf->next;
+				index = 0;
+			}
+			return *this;
+		}
+
+		inline Iterator operator++(int) {
+			Iterator it = *this;
+			++(*this);
+			return it;
+		}
+
+		inline Iterator &operator--() {
+			if (!leaf) {
+				leaf = tree->_last;
+				index = leaf ? leaf->n : 0;
+			}
+			if (!leaf || (!index && !leaf->prev))
+				throw std::logic_error("Decreasing the begin iterator");
+
+			if (!index) {
+				leaf = leaf->prev;
+				index = leaf->n;
+			}
+			--index;
+			return *this;
+		}
+
+		inline Iterator operator--(int) {
+			Iterator it = *this;
+			--(*this);
+			return it;
+		}
+
+		inline bool operator==(const Iterator &it) const {
+			if (tree != it.tree)
+				throw std::logic_error("Cannot compare iterators from different trees");
+			return leaf == it.leaf && index == it.index;
+		}
+
+		inline bool operator!=(const Iterator &it) const {
+			return !(*this == it);
+		}
+
+		inline Entry operator*() const {
+			if (!leaf)
+				throw std::logic_error("Deferencing the end iterator");
+			return { leaf->keys[index], leaf->values[index] };
+		}
+
+		struct Arrow {
+			Entry entry;
+
+			inline Entry *operator->() { return &entry; }
+		};
+
+		inline Arrow operator->() const {
+			return { **this };
+		}
+	};
+
+	inline BTreeMap() = default;
+	BTreeMap(const BTreeMap &) = delete;
+	BTreeMap &operator=(const BTreeMap &) = delete;
+
+	inline ~BTreeMap() {
+		if (_root)
+			_destroy(_root);
+	}
+
+	Iterator begin() {
+		return Iterator(_first, 0, this);
+	}
+
+	Iterator end() {
+		return Iterator(nullptr, 0, this);
+	}
+
+	inline Iterator find(const K &key) {
+		SharedLockGuard<RWLock> lg(_lock);
+		auto [leaf, i] = _get(key);
+		return Iterator(leaf, i, this);
+	}
+
+	/// @brief Insert an entry, or overwrite the value of an existing one.
+	inline void insert(K key, V value) {
+		LockGuard<RWLock> lg(_lock);
+
+		if (!_root)
+			_root = _first = _last = A::template create<Leaf>();
+
+		K splitKey;
+		Node *split;
+		if (_insert(_root, key, value, splitKey, split))
+			++_size;
+
+		if (split) {
+			Inner *root = A::template create<Inner>();
+			root->keys[0] = std::move(splitKey);
+			root->children[0] = _root;
+			root->children[1] = split;
+			root->n = 1;
+			_root = root;
+		}
+#ifndef NDEBUG
+		_verify(_root, nullptr, nullptr, true);
+#endif
+	}
+
+	inline void remove(K key) {
+		LockGuard<RWLock> lg(_lock);
+
+		if (!_root || !_remove(_root, key))
+			throw std::invalid_argument("No such entry");
+		--_size;
+
+		if (!_root->isLeaf && !_root->n) {
+			Inner *root = (Inner *)_root;
+			_root = root->children[0];
+			A::destroy(root);
+		} else if (_root->isLeaf && !_root->n) {
+			A::destroy((Leaf *)_root);
+			_root = _first = _last = nullptr;
+		}
+#ifndef NDEBUG
+		if (_root)
+			_verify(_root, nullptr, nullptr, true);
+#endif
+	}
+
+	inline bool has(K key) {
+		SharedLockGuard<RWLock> lg(_lock);
+		return _get(key).first != nullptr;
+	}
+
+	inline V &get(K key) {
+		SharedLockGuard<RWLock> lg(_lock);
+		auto [leaf, i] = _get(key);
+		if (!leaf)
+			throw std::invalid_argument("No such entry");
+		return leaf->values[i];
+	}
+
+	inline void clear() {
+		LockGuard<RWLock> lg(_lock);
+		if (_root)
+			_destroy(_root);
+		_root = _first = _last = nullptr;
+		_size = 0;
+	}
+
+	inline size_t size() const {
+		return _size;
+	}
+
+	inline void verify() {
+		SharedLockGuard<RWLock> lg(_lock);
+		if (_root)
+			_verify(_root, nullptr, nullptr, true);
+	}
+
+	/// @brief Hold off writers while iterating.
+	inline void lockShared() {
+		_lock.lockShared();
+	}
+
+	inline void unlockShared() {
+		_lock.unlockShared();
+	}
+};
+
+#endif
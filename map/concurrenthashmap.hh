@@ -0,0 +1,395 @@
+#ifndef __CONCURRENTHASHMAP_H__
+#define __CONCURRENTHASHMAP_H__
+
+#include <cstdint>
+#include <cassert>
+#include <stdexcept>
+#include <functional>
+#include <atomic>
+#include <new>
+#include "epoch.h"
+#include "pool.h"
+#include "mutex.h"
+#include "spinlock.h"
+#include "lockguard.h"
+
+/// @brief Hash map for concurrent use, with chained buckets guarded by
+/// STRIPES striped locks and lock-free lookups.
+///
+/// A writer locks the stripe of its key, bucket i belongs to stripe
+/// i % STRIPES. Lookups take no lock: a chain is only ever changed by the
+/// holder of its stripe lock, through single atomic stores of links, and
+/// nodes are never modified once linked. An update links a new node in
+/// place of the old one, and unlinked nodes are reclaimed through Epoch.
+/// Like SkipListMap, values are therefore returned by copy.
+///
+/// Each stripe counts its own entries, and the writer which finds its stripe
+/// over the load factor doubles the table. Doubling keeps the stripe of
+/// every bucket, so it moves one stripe at a time while the others stay
+/// writable: the buckets of a stripe are copied into the new table and
+/// replaced by a MOVED mark, which sends lookups and writers on to the new
+/// table. Lookups never wait for a resize.
+template <typename K, typename V, typename H = std::hash<K>, size_t STRIPES = 64, typename L = SpinLock>
+class ConcurrentHashMap final {
+	static_assert(STRIPES && !(STRIPES & (STRIPES - 1)), "The number of stripes must be a power of two");
+
+public:
+	/// @brief Average chain length at which the table is doubled.
+	constexpr static size_t MAX_LOAD = 1;
+	constexpr static size_t INITIAL_BUCKETS = STRIPES * 4;
+
+private:
+	struct Node {
+		K key;
+		V value;
+		uint64_t hash;
+		std::atomic<Node *> next;
+
+		inline Node(const K &key, V value, uint64_t hash, Node *next)
+			: key(key), value(std::move(value)), hash(hash), next(next) {}
+	};
+
+	struct Table {
+		size_t mask;
+		// The table which the buckets are being moved into, if any.
+		std::atomic<Table *> next{ nullptr };
+		// The chains which were moved, freed along with the table.
+		Node **chains = nullptr;
+
+		inline std::atomic<Node *> *buckets() {
+			return (std::atomic<Node *> *)(this + 1);
+		}
+
+		static inline Table *create(size_t nBuckets) {
+			void *p = ::operator new(sizeof(Table) + nBuckets * sizeof(std::atomic<Node *>));
+			Table *table = new (p) Table();
+			table->mask = nBuckets - 1;
+			for (size_t i = 0; i < nBuckets; ++i)
+				new (&table->buckets()[i]) std::atomic<Node *>(nullptr);
+			return table;
+		}
+
+		static inline void destroy(void *p) {
+			Table *table = (Table *)p;
+			if (table->chains) {
+				for (size_t i = 0; i <= table->mask; ++i) {
+					Node *node = table->chains[i];
+					while (node) {
+						Node *next = node->next.load(std::memory_order_relaxed);
+						PoolAllocator::destroy(node);
+						node = next;
+					}
+				}
+				delete[] table->chains;
+			}
+			table->~Table();
+			::operator delete(p);
+		}
+	};
+
+	static_assert(sizeof(Table) % alignof(std::atomic<Node *>) == 0, "Buckets must be aligned");
+
+	// Padded so that stripes never share a cache line.
+	struct alignas(64) Stripe {
+		L lock;
+		// Written under the lock, read without it by size().
+		std::atomic<size_t> size{ 0 };
+	};
+
+	std::atomic<Table *> _table;
+	Stripe _stripes[STRIPES];
+	// Held by the writer which doubles the table.
+	Mutex _resizeMutex;
+	H _hasher;
+
+	static inline Node *_moved() {
+		return (Node *)(uintptr_t)1;
+	}
+
+	inline uint64_t _hash(const K &key) const {
+		// std::hash is the identity for integers, spread the bits like HashMap
+		// does.
+		uint64_t x = (uint64_t)_hasher(key) * 0x9e3779b97f4a7c15ull;
+		return x ^ (x >> 32);
+	}
+
+	static inline Stripe &_stripeOf(Stripe *stripes, uint64_t hash) {
+		return stripes[hash & (STRIPES - 1)];
+	}
+
+	static inline void _destroyNode(void *p) {
+		PoolAllocator::destroy((Node *)p);
+	}
+
+	/// @brief The bucket of `hash` in the newest table which holds it.
+	/// @param head Set to the first node of the bucket, which lookups must
+	/// use rather than loading the bucket again, as it may be moved by now.
+	inline std::atomic<Node *> &_bucket(uint64_t hash, Node *&head) const {
+		Table *table = _table.load(std::memory_order_acquire);
+		for (;;) {
+			std::atomic<Node *> &bucket = table->buckets()[hash & table->mask];
+			head = bucket.load(std::memory_order_acquire);
+			if (head != _moved())
+				return bucket;
+			table = table->next.load(std::memory_order_acquire);
+		}
+	}
+
+	/// @brief Lock-free lookup, the caller must have entered the epoch.
+	inline Node *_get(const K &key, uint64_t hash) const {
+		Node *head;
+		_bucket(hash, head);
+		for (Node *i = head; i; i = i->next.load(std::memory_order_acquire)) {
+			if (i->hash == hash && i->key == key)
+				return i;
+		}
+		return nullptr;
+	}
+
+	/// @brief The link which points at the node of `key`, or at nullptr at
+	/// the end of its chain. The caller must hold the stripe lock.
+	inline std::atomic<Node *> &_link(const K &key, uint64_t hash) {
+		Node *head;
+		std::atomic<Node *> *link = &_bucket(hash, head);
+		for (Node *i = head; i; i = link->load(std::memory_order_relaxed)) {
+			if (i->hash == hash && i->key == key)
+				break;
+			link = &i->next;
+		}
+		return *link;
+	}
+
+	/// @brief Link `node` in place of the node which `link` points at, which
+	/// is retired.
+	static inline void _replace(std::atomic<Node *> &link, Node *node) {
+		Node *old = link.load(std::memory_order_relaxed);
+		node->next.store(old->next.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		link.store(node, std::memory_order_release);
+		Epoch::retire(old, _destroyNode);
+	}
+
+	/// @brief Account for an inserted entry, called with the stripe lock held.
+	/// @return Whether the stripe is over the load factor.
+	inline bool _grown(Stripe &stripe) const {
+		size_t size = stripe.size.load(std::memory_order_relaxed) + 1;
+		stripe.size.store(size, std::memory_order_relaxed);
+		size_t nBuckets = _table.load(std::memory_order_relaxed)->mask + 1;
+		return size > nBuckets / STRIPES * MAX_LOAD;
+	}
+
+	/// @brief Double the table, unless another writer is doing so. Must be
+	/// called without holding a stripe lock, nor the epoch, which would keep
+	/// it from advancing for the whole resize.
+	inline void _resize() {
+		if (!_resizeMutex.tryLock())
+			return;
+
+		Table *old = _table.load(std::memory_order_relaxed);
+		size_t nOld = old->mask + 1;
+		Table *table = Table::create(nOld * 2);
+		old->chains = new Node *[nOld];
+		old->next.store(table, std::memory_order_release);
+
+		for (size_t s = 0; s < STRIPES; ++s) {
+			LockGuard<L> lg(_stripes[s].lock);
+			for (size_t b = s; b < nOld; b += STRIPES) {
+				Node *head = old->buckets()[b].load(std::memory_order_relaxed);
+				old->chains[b] = head;
+				// Copied rather than relinked, so that lookups which are still
+				// walking the old chain find their way to its end.
+				for (Node *i = head; i; i = i->next.load(std::memory_order_relaxed)) {
+					std::atomic<Node *> &bucket = table->buckets()[i->hash & table->mask];
+					bucket.store(PoolAllocator::create<Node>(i->key, i->value, i->hash, bucket.load(std::memory_order_relaxed)),
+						std::memory_order_relaxed);
+				}
+				// Publishes the new chains too.
+				old->buckets()[b].store(_moved(), std::memory_order_release);
+			}
+		}
+
+		_table.store(table, std::memory_order_release);
+		// Retiring the old nodes one by one would swamp Epoch.
+		Epoch::retire(old, Table::destroy);
+		_resizeMutex.unlock();
+	}
+
+	/// @brief Insert `value` at the end of its chain, or replace the value of
+	/// an existing entry if `replace`.
+	/// @return Whether the entry was inserted.
+	inline bool _insert(const K &key, const V &value, bool replace) {
+		uint64_t hash = _hash(key);
+		Stripe &stripe = _stripeOf(_stripes, hash);
+		bool resize;
+		{
+			Epoch::Guard guard;
+			LockGuard<L> lg(stripe.lock);
+			std::atomic<Node *> &link = _link(key, hash);
+			if (link.load(std::memory_order_relaxed)) {
+				if (replace)
+					_replace(link, PoolAllocator::create<Node>(key, value, hash, nullptr));
+				return false;
+			}
+
+			link.store(PoolAllocator::create<Node>(key, value, hash, nullptr), std::memory_order_release);
+			resize = _grown(stripe);
+		}
+		if (resize)
+			_resize();
+		return true;
+	}
+
+	template <typename F>
+	inline void _forEach(Table *table, size_t b, F &fn) const {
+		Node *i = table->buckets()[b].load(std::memory_order_acquire);
+		if (i == _moved()) {
+			Table *next = table->next.load(std::memory_order_acquire);
+			_forEach(next, b, fn);
+			_forEach(next, b + table->mask + 1, fn);
+			return;
+		}
+		for (; i; i = i->next.load(std::memory_order_acquire))
+			fn(i->key, i->value);
+	}
+
+public:
+	inline ConcurrentHashMap() : _table(Table::create(INITIAL_BUCKETS)) {}
+
+	ConcurrentHashMap(const ConcurrentHashMap &) = delete;
+	ConcurrentHashMap &operator=(const ConcurrentHashMap &) = delete;
+
+	/// @brief Must not run concurrently with any other operation.
+	inline ~ConcurrentHashMap() {
+		Table *table = _table.load(std::memory_order_relaxed);
+		assert(!table->next.load(std::memory_order_relaxed));
+		for (size_t b = 0; b <= table->mask; ++b) {
+			Node *i = table->buckets()[b].load(std::memory_order_relaxed);
+			while (i) {
+				Node *next = i->next.load(std::memory_order_relaxed);
+				PoolAllocator::destroy(i);
+				i = next;
+			}
+		}
+		Table::destroy(table);
+	}
+
+	/// @brief Insert an entry, or replace the value of an existing one.
+	/// @return Whether the entry was inserted.
+	inline bool insert(const K &key, const V &value) {
+		return _insert(key, value, true);
+	}
+
+	/// @brief Insert an entry unless the key exists.
+	/// @return Whether the entry was inserted.
+	inline bool tryInsert(const K &key, const V &value) {
+		return _insert(key, value, false);
+	}
+
+	/// @brief Update the value of `key` with fn(V &), which is called on a
+	/// copy of the current value, or on V() if there is none, under the
+	/// stripe lock. The updated copy replaces the entry atomically, so
+	/// concurrent updates of a key never get lost.
+	/// @return Whether the entry was inserted.
+	template <typename F>
+	inline bool upsert(const K &key, F &&fn) {
+		uint64_t hash = _hash(key);
+		Stripe &stripe = _stripeOf(_stripes, hash);
+		bool resize;
+		{
+			Epoch::Guard guard;
+			LockGuard<L> lg(stripe.lock);
+			std::atomic<Node *> &link = _link(key, hash);
+			Node *node = link.load(std::memory_order_relaxed);
+			V value = node ? node->value : V();
+			fn(value);
+			if (node) {
+				_replace(link, PoolAllocator::create<Node>(key, std::move(value), hash, nullptr));
+				return false;
+			}
+
+			link.store(PoolAllocator::create<Node>(key, std::move(value), hash, nullptr), std::memory_order_release);
+			resize = _grown(stripe);
+		}
+		if (resize)
+			_resize();
+		return true;
+	}
+
+	/// @return Whether an entry was removed.
+	inline bool erase(const K &key) {
+		Epoch::Guard guard;
+		uint64_t hash = _hash(key);
+		Stripe &stripe = _stripeOf(_stripes, hash);
+		LockGuard<L> lg(stripe.lock);
+
+		std::atomic<Node *> &link = _link(key, hash);
+		Node *node = link.load(std::memory_order_relaxed);
+		if (!node)
+			return false;
+
+		// Lookups which are on the node still find their way on from it.
+		link.store(node->next.load(std::memory_order_relaxed), std::memory_order_release);
+		Epoch::retire(node, _destroyNode);
+		stripe.size.store(stripe.size.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	inline void remove(const K &key) {
+		if (!erase(key))
+			throw std::invalid_argument("No such entry");
+	}
+
+	inline bool has(const K &key) const {
+		Epoch::Guard guard;
+		return _get(key, _hash(key)) != nullptr;
+	}
+
+	inline bool contains(const K &key) const {
+		return has(key);
+	}
+
+	inline V get(const K &key) const {
+		Epoch::Guard guard;
+		Node *node = _get(key, _hash(key));
+		if (!node)
+			throw std::invalid_argument("No such entry");
+		return node->value;
+	}
+
+	/// @brief Copy the value of `key` into `value`.
+	/// @return Whether the key exists.
+	inline bool tryGet(const K &key, V &value) const {
+		Epoch::Guard guard;
+		Node *node = _get(key, _hash(key));
+		if (!node)
+			return false;
+		value = node->value;
+		return true;
+	}
+
+	/// @brief Call fn(const K &, const V &) on every entry, in no particular
+	/// order. Weakly consistent: entries inserted or removed meanwhile may or
+	/// may not be visited.
+	template <typename F>
+	inline void forEach(F &&fn) const {
+		Epoch::Guard guard;
+		Table *table = _table.load(std::memory_order_acquire);
+		for (size_t b = 0; b <= table->mask; ++b)
+			_forEach(table, b, fn);
+	}
+
+	/// @brief Number of entries, exact only while there are no concurrent
+	/// writers.
+	inline size_t size() const {
+		size_t n = 0;
+		for (auto &i : _stripes)
+			n += i.size.load(std::memory_order_relaxed);
+		return n;
+	}
+
+	/// @brief Number of buckets of the current table.
+	inline size_t bucketCount() const {
+		return _table.load(std::memory_order_acquire)->mask + 1;
+	}
+};
+
+#endif
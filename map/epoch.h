@@ -0,0 +1,208 @@
+#ifndef __EPOCH_H__
+#define __EPOCH_H__
+
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+
+/// @brief Epoch-based reclamation for lock-free containers.
+///
+/// Readers pin the current global epoch for the duration of an operation
+/// (see Guard). Memory which was unlinked from a shared structure is handed
+/// to retire() instead of being freed, and freed once the global epoch has
+/// advanced twice past the epoch it was retired in. The epoch only advances
+/// when every pinned thread has observed the current one, so by then no
+/// thread can still hold a reference obtained before the unlink.
+class Epoch final {
+public:
+	using Deleter = void (*)(void *);
+
+	/// @brief Number of retirements between attempts to advance the epoch
+	/// and free retired memory.
+	constexpr static size_t COLLECT_INTERVAL = 64;
+
+	/// @brief Pins the current epoch, may be nested.
+	class Guard final {
+	public:
+		inline Guard() { Epoch::enter(); }
+		inline ~Guard() { Epoch::leave(); }
+
+		Guard(const Guard &) = delete;
+		Guard &operator=(const Guard &) = delete;
+	};
+
+private:
+	constexpr static uint64_t IDLE = UINT64_MAX;
+
+	struct Retired {
+		Retired *next;
+		void *p;
+		Deleter deleter;
+		uint64_t epoch;
+	};
+
+	/// @brief Per-thread announcement of the pinned epoch. Records are never
+	/// freed, threads which exit leave them to be adopted by new threads.
+	struct alignas(64) Record {
+		std::atomic<uint64_t> epoch{ IDLE };
+		std::atomic<bool> inUse{ true };
+		Record *next = nullptr;
+	};
+
+	/// @brief Thread-local state, trivially destructible like SizeClassPool
+	/// so that it stays usable during the destruction of globals.
+	struct Local {
+		Record *record;
+		unsigned nesting;
+		Retired *retired;
+		size_t nRetired;
+	};
+
+	struct Globals {
+		std::atomic<uint64_t> epoch{ 0 };
+		std::atomic<Record *> records{ nullptr };
+		// Memory retired by threads which have exited.
+		std::mutex orphansMutex;
+		Retired *orphans = nullptr;
+	};
+
+	static inline Globals &_globals() {
+		static Globals globals;
+		return globals;
+	}
+
+	static inline Record *_acquireRecord() {
+		Globals &g = _globals();
+		for (Record *i = g.records.load(std::memory_order_acquire); i; i = i->next) {
+			bool inUse = false;
+			if (!i->inUse.load(std::memory_order_relaxed) && i->inUse.compare_exchange_strong(inUse, true))
+				return i;
+		}
+
+		Record *record = new Record();
+		Record *head = g.records.load(std::memory_order_relaxed);
+		do
+			record->next = head;
+		while (!g.records.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+		return record;
+	}
+
+	/// @brief Advance the global epoch if every pinned thread is in it.
+	static inline uint64_t _tryAdvance() {
+		Globals &g = _globals();
+		uint64_t epoch = g.epoch.load();
+
+		for (Record *i = g.records.load(std::memory_order_acquire); i; i = i->next) {
+			uint64_t e = i->epoch.load();
+			if (e != IDLE && e != epoch)
+				return epoch;
+		}
+
+		if (g.epoch.compare_exchange_strong(epoch, epoch + 1))
+			return epoch + 1;
+		return epoch;
+	}
+
+	/// @brief Free the entries of a list which are safe to free by now.
+	/// @return The remaining entries.
+	static inline Retired *_collect(Retired *list, uint64_t epoch, size_t &nFreed) {
+		Retired *kept = nullptr;
+		while (list) {
+			Retired *next = list->next;
+			if (list->epoch + 2 <= epoch) {
+				list->deleter(list->p);
+				delete list;
+				++nFreed;
+			} else {
+				list->next = kept;
+				kept = list;
+			}
+			list = next;
+		}
+		return kept;
+	}
+
+	static inline void _collect(Local &l) {
+		uint64_t epoch = _tryAdvance();
+		size_t nFreed = 0;
+		l.retired = _collect(l.retired, epoch, nFreed);
+		l.nRetired -= nFreed;
+
+		Globals &g = _globals();
+		std::unique_lock<std::mutex> lock(g.orphansMutex, std::try_to_lock);
+		if (lock.owns_lock() && g.orphans)
+			g.orphans = _collect(g.orphans, epoch, nFreed);
+	}
+
+	static inline Local &_local() {
+		struct Reaper {
+			inline ~Reaper() {
+				Local &l = _local();
+				if (l.retired) {
+					Globals &g = _globals();
+					std::lock_guard<std::mutex> lg(g.orphansMutex);
+					Retired *last = l.retired;
+					while (last->next)
+						last = last->next;
+					last->next = g.orphans;
+					g.orphans = l.retired;
+					l.retired = nullptr;
+					l.nRetired = 0;
+				}
+				if (l.record && !l.nesting) {
+					l.record->inUse.store(false, std::memory_order_release);
+					l.record = nullptr;
+				}
+			}
+		};
+
+		thread_local Local local = {};
+		thread_local Reaper reaper;
+		(void)reaper;
+		return local;
+	}
+
+public:
+	static inline void enter() {
+		Local &l = _local();
+		if (l.nesting++)
+			return;
+
+		if (!l.record)
+			l.record = _acquireRecord();
+		// Must be visible to _tryAdvance() before any shared pointer is read.
+		l.record->epoch.store(_globals().epoch.load(std::memory_order_relaxed));
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+
+	static inline void leave() {
+		Local &l = _local();
+		if (!--l.nesting)
+			l.record->epoch.store(IDLE, std::memory_order_release);
+	}
+
+	/// @brief Free `p` with `deleter` once no thread can reference it any
+	/// more. `p` must have been unlinked already.
+	static inline void retire(void *p, Deleter deleter) {
+		Local &l = _local();
+		l.retired = new Retired{ l.retired, p, deleter, _globals().epoch.load() };
+
+		if (++l.nRetired % COLLECT_INTERVAL == 0)
+			_collect(l);
+	}
+
+	template <typename T>
+	static inline void retire(T *p) {
+		retire(p, [](void *p) { delete (T *)p; });
+	}
+
+	/// @brief Try to free retired memory now, e.g. before measuring memory
+	/// usage. Nothing is freed while other threads are pinned.
+	static inline void collect() {
+		Local &l = _local();
+		for (int i = 0; i < 3; ++i)
+			_collect(l);
+	}
+};
+
+#endif
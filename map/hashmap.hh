@@ -1,37 +1,601 @@
 #ifndef __HASHMAP_H__
 #define __HASHMAP_H__
 
-#include <xhash>
-#include <string>
-#include <memory>
-#include "../list/list.hh
-#include "../map/tree.h"
-#include "../list/dynarray.hh"
-
-template <typename K, typename V, typename H = std::hash<K>>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <stdexcept>
+#include <functional>
+#include <utility>
+#include <algorithm>
+#include <new>
+#include "lockguard.h"
+#include "nulllock.h"
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+#elif defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
+
+/// @brief Open-addressing hash map in the style of Swiss tables.
+///
+/// Every slot owns one control byte, which is either EMPTY, DELETED or the
+/// lower 7 bits of the key's hash (H2). Control bytes are scanned a whole
+/// group at a time (SSE2/AVX2 when available, SWAR otherwise), so most
+/// lookups touch one control group and one slot.
+///
+/// Growing does not rehash all entries at once: the full table becomes the
+/// old table, and every following insertion or removal moves the next
+/// MIGRATE_BUDGET of its slots over to the new table, so no single
+/// operation pays for more than a few entries. Lookups consult both tables
+/// meanwhile. The new table keeps room for every entry that is still to be
+/// moved, and at least 7/16 of its slots for new ones, so the old table is
+/// always drained before the new one fills up. Removing through an iterator
+/// moves nothing, so entries stay in place while iterating.
+///
+/// L is the lock policy. The default NullLock leaves synchronization to the
+/// caller, RWLock, Mutex or SpinLock make every operation thread-safe.
+/// Entries returned by reference or through iterators are not protected.
+template <typename K, typename V, typename H = std::hash<K>, typename L = NullLock>
 class HashMap {
 public:
-	struct Node {
-		decltype(H::operator()) hash;
+	struct Entry {
 		K key;
 		V value;
 
-		inline Node(decltype(hash) hash, K key, V value) : hash(hash), key(key), value(value) {}
+		inline Entry(K key, V value) : key(std::move(key)), value(std::move(value)) {}
 	};
 
-private:
-	DynArray<RBTree<Node>> _buckets;
+	/// @brief Number of keys which findBatch() prefetches for at a time.
+	constexpr static size_t BATCH_WIDTH = 16;
 
 private:
-	inline void put(K key, V value) {
-		auto hash = H(key);
-		size_t index = hash % _buckets.size();
+	using Ctrl = int8_t;
+	constexpr static Ctrl EMPTY = -128, DELETED = -2;
+
+	/// @brief One probing unit of control bytes, each bit of a mask stands
+	/// for a slot (spread by SHIFT bits on the SWAR implementation).
+	struct Group {
+#if defined(__AVX2__)
+		constexpr static size_t WIDTH = 32, SHIFT = 0;
+		__m256i ctrl;
+
+		inline explicit Group(const Ctrl *p) : ctrl(_mm256_load_si256((const __m256i *)p)) {}
+
+		inline uint64_t match(Ctrl h2) const {
+			return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_set1_epi8(h2), ctrl));
+		}
+		inline uint64_t matchEmpty() const { return match(EMPTY); }
+		inline uint64_t matchEmptyOrDeleted() const { return (uint32_t)_mm256_movemask_epi8(ctrl); }
+#elif defined(__SSE2__)
+		constexpr static size_t WIDTH = 16, SHIFT = 0;
+		__m128i ctrl;
+
+		inline explicit Group(const Ctrl *p) : ctrl(_mm_load_si128((const __m128i *)p)) {}
+
+		inline uint64_t match(Ctrl h2) const {
+			return (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl));
+		}
+		inline uint64_t matchEmpty() const { return match(EMPTY); }
+		inline uint64_t matchEmptyOrDeleted() const { return (uint16_t)_mm_movemask_epi8(ctrl); }
+#else
+		constexpr static size_t WIDTH = 8, SHIFT = 3;
+		constexpr static uint64_t LSBS = 0x0101010101010101ull, MSBS = 0x8080808080808080ull;
+		uint64_t ctrl;
+
+		inline explicit Group(const Ctrl *p) { memcpy(&ctrl, p, sizeof(ctrl)); }
+
+		// May report false positives, which are filtered out by the key comparison.
+		inline uint64_t match(Ctrl h2) const {
+			uint64_t x = ctrl ^ (LSBS * (uint8_t)h2);
+			return (x - LSBS) & ~x & MSBS;
+		}
+		inline uint64_t matchEmpty() const { return ctrl & ~(ctrl << 6) & MSBS; }
+		inline uint64_t matchEmptyOrDeleted() const { return ctrl & MSBS; }
+#endif
+
+		static inline size_t lowest(uint64_t mask) {
+			return (size_t)__builtin_ctzll(mask) >> SHIFT;
+		}
+	};
+
+	constexpr static size_t GROUP_WIDTH = Group::WIDTH;
+	// Old slots moved per operation while growing. Draining C old slots
+	// takes C / 4 insertions, well within the 7/16 C of room left in the
+	// new table even when it is rebuilt at the same capacity.
+	constexpr static size_t MIGRATE_BUDGET = 4;
+
+	Ctrl *_ctrl = nullptr;
+	Entry *_slots = nullptr;
+	size_t _capacity = 0, _size = 0, _growthLeft = 0;
+	// The table which is being moved into the one above, if any. Slots
+	// before _migrated have been moved and are DELETED.
+	Ctrl *_oldCtrl = nullptr;
+	Entry *_oldSlots = nullptr;
+	size_t _oldCapacity = 0, _migrated = 0;
+	H _hasher;
+	[[no_unique_address]] mutable L _lock;
+
+	static inline uint64_t _hash(const H &hasher, const K &key) {
+		// std::hash is the identity for integers, spread the entropy over all
+		// bits so both the probe start (H1) and the control tag (H2) are usable.
+		uint64_t x = (uint64_t)hasher(key) * 0x9e3779b97f4a7c15ull;
+		return x ^ (x >> 32);
+	}
+
+	static inline size_t _h1(uint64_t hash) { return (size_t)(hash >> 7); }
+	static inline Ctrl _h2(uint64_t hash) { return (Ctrl)(hash & 0x7f); }
+
+	static inline size_t _maxLoad(size_t capacity) {
+		return capacity - capacity / 8;
+	}
+
+	static inline bool _isFull(Ctrl c) { return c >= 0; }
+
+	/// @brief Quadratic probing over whole groups, visits every group exactly
+	/// once since the number of groups is a power of two.
+	struct Probe {
+		size_t mask, group, step = 0;
+
+		inline Probe(size_t hash, size_t nGroups) : mask(nGroups - 1), group(hash & (nGroups - 1)) {}
+
+		inline size_t offset() const { return group * GROUP_WIDTH; }
+		inline void next() {
+			++step;
+			group = (group + step) & mask;
+		}
+	};
+
+	/// @return The slot of `key` in the table, or `capacity`.
+	static inline size_t _findIn(const Ctrl *ctrl, const Entry *slots, size_t capacity, const K &key, uint64_t hash) {
+		if (!capacity)
+			return capacity;
+
+		Ctrl h2 = _h2(hash);
+		for (Probe probe(_h1(hash), capacity / GROUP_WIDTH);; probe.next()) {
+			Group g(ctrl + probe.offset());
+
+			for (uint64_t m = g.match(h2); m; m &= m - 1) {
+				size_t i = probe.offset() + Group::lowest(m);
+				if (slots[i].key == key)
+					return i;
+			}
+
+			if (g.matchEmpty())
+				return capacity;
+		}
+	}
+
+	/// @return The position of `key` over both tables, where slots of the
+	/// old table follow those of the new one, or _end().
+	inline size_t _find(const K &key, uint64_t hash) const {
+		size_t i = _findIn(_ctrl, _slots, _capacity, key, hash);
+		if (i != _capacity || !_oldCtrl)
+			return i == _capacity ? _end() : i;
+
+		i = _findIn(_oldCtrl, _oldSlots, _oldCapacity, key, hash);
+		return i == _oldCapacity ? _end() : _capacity + i;
+	}
+
+	inline size_t _end() const {
+		return _capacity + _oldCapacity;
+	}
+
+	inline Ctrl _ctrlAt(size_t i) const {
+		return i < _capacity ? _ctrl[i] : _oldCtrl[i - _capacity];
+	}
+
+	inline Entry &_slotAt(size_t i) const {
+		return i < _capacity ? _slots[i] : _oldSlots[i - _capacity];
+	}
+
+	/// @brief Find the first EMPTY or DELETED slot on the probe sequence.
+	static inline size_t _findFree(const Ctrl *ctrl, size_t capacity, uint64_t hash) {
+		for (Probe probe(_h1(hash), capacity / GROUP_WIDTH);; probe.next()) {
+			uint64_t m = Group(ctrl + probe.offset()).matchEmptyOrDeleted();
+			if (m)
+				return probe.offset() + Group::lowest(m);
+		}
+	}
+
+	static inline Ctrl *_allocCtrl(size_t capacity) {
+		Ctrl *ctrl = (Ctrl *)::operator new(capacity, std::align_val_t(GROUP_WIDTH));
+		memset(ctrl, EMPTY, capacity);
+		return ctrl;
+	}
+
+	static inline Entry *_allocSlots(size_t capacity) {
+		return (Entry *)::operator new(capacity * sizeof(Entry), std::align_val_t(alignof(Entry)));
+	}
+
+	static inline void _freeCtrl(Ctrl *ctrl) {
+		::operator delete(ctrl, std::align_val_t(GROUP_WIDTH));
+	}
+
+	static inline void _freeSlots(Entry *slots) {
+		::operator delete(slots, std::align_val_t(alignof(Entry)));
+	}
+
+	static inline void _destroyTable(Ctrl *ctrl, Entry *slots, size_t capacity) {
+		for (size_t i = 0; i < capacity; ++i) {
+			if (_isFull(ctrl[i]))
+				slots[i].~Entry();
+		}
+		_freeCtrl(ctrl);
+		_freeSlots(slots);
+	}
+
+	inline void _destroyAll() {
+		_destroyTable(_ctrl, _slots, _capacity);
+		_ctrl = nullptr;
+		_slots = nullptr;
+		if (_oldCtrl) {
+			_destroyTable(_oldCtrl, _oldSlots, _oldCapacity);
+			_oldCtrl = nullptr;
+			_oldSlots = nullptr;
+			_oldCapacity = 0;
+		}
+	}
+
+	/// @brief Move an entry of the old table into the new one, which has
+	/// room reserved for it.
+	inline void _migrate(size_t i) {
+		Entry &entry = _oldSlots[i];
+		uint64_t hash = _hash(_hasher, entry.key);
+		size_t j = _findFree(_ctrl, _capacity, hash);
+		_ctrl[j] = _h2(hash);
+		new (_slots + j) Entry(std::move(entry));
+		entry.~Entry();
+		// Still part of probe sequences of the entries which are left.
+		_oldCtrl[i] = DELETED;
+	}
+
+	/// @brief Move the next MIGRATE_BUDGET slots of the old table, called
+	/// by every insertion and removal by key.
+	inline void _migrateStep() {
+		if (!_oldCtrl)
+			return;
+
+		for (size_t end = _migrated + MIGRATE_BUDGET; _migrated < end; ++_migrated) {
+			if (_isFull(_oldCtrl[_migrated]))
+				_migrate(_migrated);
+		}
+
+		if (_migrated == _oldCapacity) {
+			_freeCtrl(_oldCtrl);
+			_freeSlots(_oldSlots);
+			_oldCtrl = nullptr;
+			_oldSlots = nullptr;
+			_oldCapacity = 0;
+		}
+	}
+
+	inline void _finishMigration() {
+		while (_oldCtrl)
+			_migrateStep();
+	}
+
+	/// @brief Make the current table the old one, to be moved into a new
+	/// table of `newCapacity` slots by _migrateStep().
+	inline void _startMigration(size_t newCapacity) {
+		assert(!_oldCtrl);
+		assert(_maxLoad(newCapacity) >= _size);
+
+		_oldCtrl = _ctrl;
+		_oldSlots = _slots;
+		_oldCapacity = _capacity;
+		_migrated = 0;
+
+		_ctrl = _allocCtrl(newCapacity);
+		_slots = _allocSlots(newCapacity);
+		_capacity = newCapacity;
+		// Counting the entries which are still to be moved.
+		_growthLeft = _maxLoad(newCapacity) - _size;
+	}
+
+	/// @brief Rehash into a new table at once.
+	inline void _rehash(size_t newCapacity) {
+		_finishMigration();
+		assert(newCapacity >= GROUP_WIDTH);
+		assert(!(newCapacity & (newCapacity - 1)));
+		assert(_maxLoad(newCapacity) >= _size);
+
+		Ctrl *newCtrl = _allocCtrl(newCapacity);
+		Entry *newSlots = _allocSlots(newCapacity);
+
+		for (size_t i = 0; i < _capacity; ++i) {
+			if (!_isFull(_ctrl[i]))
+				continue;
 
-		if (_buckets.at(index).size()) {
-			fprintf(stderr, "Warning: hash conflicted at bucket #%zu\n", index);
+			uint64_t hash = _hash(_hasher, _slots[i].key);
+			size_t j = _findFree(newCtrl, newCapacity, hash);
+			newCtrl[j] = _h2(hash);
+			new (newSlots + j) Entry(std::move(_slots[i]));
+			_slots[i].~Entry();
 		}
 
-		_buckets.at(index).insert(Node(hash, std::move(key), std::move(value)));
+		if (_ctrl) {
+			_freeCtrl(_ctrl);
+			_freeSlots(_slots);
+		}
+		_ctrl = newCtrl;
+		_slots = newSlots;
+		_capacity = newCapacity;
+		_growthLeft = _maxLoad(newCapacity) - _size;
+	}
+
+	inline void _reserveOne() {
+		if (_growthLeft)
+			return;
+
+		// Only if removals left many tombstones in the new table.
+		_finishMigration();
+
+		if (!_capacity)
+			_rehash(GROUP_WIDTH);
+		else if (_size * 2 > _maxLoad(_capacity))
+			_startMigration(_capacity * 2);
+		else
+			// Mostly tombstones, squeeze them out without growing.
+			_startMigration(_capacity);
+	}
+
+	/// @brief Find a slot for a key which is known to be absent, growing
+	/// the table if needed. The slot is only claimed by _claim() once the
+	/// entry has been constructed in it, so that a throwing constructor
+	/// leaves no FULL slot without an entry behind.
+	inline size_t _prepareInsert(uint64_t hash) {
+		if (!_capacity)
+			_reserveOne();
+
+		size_t i = _findFree(_ctrl, _capacity, hash);
+		if (_ctrl[i] == EMPTY && !_growthLeft) {
+			_reserveOne();
+			i = _findFree(_ctrl, _capacity, hash);
+		}
+		return i;
+	}
+
+	inline void _claim(size_t i, uint64_t hash) {
+		if (_ctrl[i] == EMPTY)
+			--_growthLeft;
+		_ctrl[i] = _h2(hash);
+		++_size;
+	}
+
+	/// @brief Remove the entry at a position from _find().
+	inline void _erase(size_t i) {
+		if (i >= _capacity) {
+			i -= _capacity;
+			assert(_isFull(_oldCtrl[i]));
+			_oldSlots[i].~Entry();
+			_oldCtrl[i] = DELETED;
+			--_size;
+			// Its room in the new table is no longer needed.
+			++_growthLeft;
+			return;
+		}
+
+		assert(_isFull(_ctrl[i]));
+
+		_slots[i].~Entry();
+		--_size;
+
+		// Lookups only stop at groups that have an EMPTY slot, so if this
+		// group already has one, no probe sequence passes through it and the
+		// slot can go straight back to EMPTY instead of being a tombstone.
+		size_t groupBegin = i & ~(GROUP_WIDTH - 1);
+		if (Group(_ctrl + groupBegin).matchEmpty()) {
+			_ctrl[i] = EMPTY;
+			++_growthLeft;
+		} else
+			_ctrl[i] = DELETED;
+	}
+
+public:
+	struct Iterator {
+		size_t index;
+		HashMap *map;
+
+		inline Iterator(const Iterator &it) = default;
+		inline Iterator(size_t index, HashMap *map) : index(index), map(map) {
+			_skip();
+		}
+
+		inline Iterator &operator=(const Iterator &rhs) noexcept = default;
+
+		inline void _skip() {
+			while (index < map->_end() && !_isFull(map->_ctrlAt(index)))
+				++index;
+		}
+
+		inline Iterator &operator++() {
+			if (index >= map->_end())
+				throw std::logic_error("Increasing the end iterator");
+			++index;
+			_skip();
+			return *this;
+		}
+
+		inline Iterator operator++(int) {
+			Iterator it = *this;
+			++(*this);
+			return it;
+		}
+
+		inline bool operator==(const Iterator &it) const {
+			if (map != it.map)
+				throw std::logic_error("Cannot compare iterators from different maps");
+			return index == it.index;
+		}
+
+		inline bool operator!=(const Iterator &it) const {
+			return !(*this == it);
+		}
+
+		inline Entry &operator*() const {
+			if (index >= map->_end())
+				throw std::logic_error("Deferencing the end iterator");
+			return map->_slotAt(index);
+		}
+
+		inline Entry *operator->() const {
+			return &**this;
+		}
+	};
+
+	inline HashMap() = default;
+	HashMap(const HashMap &) = delete;
+	HashMap &operator=(const HashMap &) = delete;
+
+	inline ~HashMap() {
+		if (_ctrl)
+			_destroyAll();
+	}
+
+	inline Iterator begin() {
+		return Iterator(0, this);
+	}
+
+	inline Iterator end() {
+		return Iterator(_end(), this);
+	}
+
+	inline Iterator find(const K &key) {
+		SharedLockGuard<L> lg(_lock);
+		return Iterator(_find(key, _hash(_hasher, key)), this);
+	}
+
+	inline bool has(const K &key) const {
+		SharedLockGuard<L> lg(_lock);
+		return _find(key, _hash(_hasher, key)) != _end();
+	}
+
+	inline V &get(const K &key) {
+		SharedLockGuard<L> lg(_lock);
+		size_t i = _find(key, _hash(_hasher, key));
+		if (i == _end())
+			throw std::invalid_argument("No such entry");
+		return _slotAt(i).value;
+	}
+
+	/// @brief Look up `n` keys under one lock, setting out[i] to the value
+	/// of keys[i] or nullptr. Keys go through in groups of BATCH_WIDTH: all
+	/// of them are hashed and their control groups prefetched, then their
+	/// candidate slots, and only then compared, so that the cache misses of
+	/// a group overlap.
+	inline void findBatch(const K *keys, size_t n, V **out) {
+		SharedLockGuard<L> lg(_lock);
+		uint64_t hashes[BATCH_WIDTH];
+
+		for (size_t i = 0; i < n; i += BATCH_WIDTH) {
+			size_t m = std::min(n - i, BATCH_WIDTH);
+			for (size_t j = 0; j < m; ++j) {
+				hashes[j] = _hash(_hasher, keys[i + j]);
+				if (_capacity)
+					__builtin_prefetch(_ctrl + Probe(_h1(hashes[j]), _capacity / GROUP_WIDTH).offset());
+			}
+
+			if (_capacity) {
+				for (size_t j = 0; j < m; ++j) {
+					size_t offset = Probe(_h1(hashes[j]), _capacity / GROUP_WIDTH).offset();
+					uint64_t match = Group(_ctrl + offset).match(_h2(hashes[j]));
+					if (match)
+						__builtin_prefetch(_slots + offset + Group::lowest(match));
+				}
+			}
+
+			for (size_t j = 0; j < m; ++j) {
+				size_t k = _find(keys[i + j], hashes[j]);
+				out[i + j] = k == _end() ? nullptr : &_slotAt(k).value;
+			}
+		}
+	}
+
+	/// @brief Insert an entry, or overwrite the value if the key exists.
+	/// @return Whether a new entry was inserted.
+	inline bool insert(K key, V value) {
+		LockGuard<L> lg(_lock);
+		_migrateStep();
+		uint64_t hash = _hash(_hasher, key);
+		size_t i = _find(key, hash);
+		if (i != _end()) {
+			_slotAt(i).value = std::move(value);
+			return false;
+		}
+
+		i = _prepareInsert(hash);
+		new (_slots + i) Entry(std::move(key), std::move(value));
+		_claim(i, hash);
+		return true;
+	}
+
+	inline V &operator[](const K &key) {
+		LockGuard<L> lg(_lock);
+		_migrateStep();
+		uint64_t hash = _hash(_hasher, key);
+		size_t i = _find(key, hash);
+		if (i == _end()) {
+			i = _prepareInsert(hash);
+			new (_slots + i) Entry(key, V());
+			_claim(i, hash);
+		}
+		return _slotAt(i).value;
+	}
+
+	inline void remove(const K &key) {
+		LockGuard<L> lg(_lock);
+		_migrateStep();
+		size_t i = _find(key, _hash(_hasher, key));
+		if (i == _end())
+			throw std::invalid_argument("No such entry");
+		_erase(i);
+	}
+
+	inline void remove(Iterator where) {
+		LockGuard<L> lg(_lock);
+		if (where.index >= _end())
+			throw std::logic_error("Removing the end iterator");
+		// No migration step, so that the other entries stay in place for an
+		// iteration which removes as it goes.
+		_erase(where.index);
+	}
+
+	/// @brief Make room for at least `n` entries without further rehashing,
+	/// finishing any pending migration first.
+	inline void reserve(size_t n) {
+		LockGuard<L> lg(_lock);
+		_finishMigration();
+		size_t capacity = _capacity ? _capacity : GROUP_WIDTH;
+		while (_maxLoad(capacity) < n)
+			capacity *= 2;
+		if (capacity != _capacity)
+			_rehash(capacity);
+	}
+
+	inline void clear() {
+		LockGuard<L> lg(_lock);
+		if (_ctrl)
+			_destroyAll();
+		_capacity = 0, _size = 0, _growthLeft = 0;
+	}
+
+	inline size_t size() const {
+		return _size;
+	}
+
+	inline size_t capacity() const {
+		return _capacity;
+	}
+
+	/// @brief Hold off writers, e.g. for the duration of an iteration.
+	inline void lockShared() {
+		_lock.lockShared();
+	}
+
+	inline void unlockShared() {
+		_lock.unlockShared();
 	}
 };
 
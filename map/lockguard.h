@@ -23,4 +23,23 @@ public:
 	inline void tryUnlock() { _lock.tryUnlock(); }
 };
 
+template <typename T>
+class SharedLockGuard final {
+private:
+	T &_lock;
+
+public:
+	inline SharedLockGuard(T &lock) : _lock(lock) { _lock.lockShared(); }
+	SharedLockGuard(const SharedLockGuard<T> &) = delete;
+	SharedLockGuard(const SharedLockGuard<T> &&) = delete;
+
+	inline ~SharedLockGuard() { _lock.unlockShared(); }
+
+	SharedLockGuard<T> &operator=(const SharedLockGuard<T> &) = delete;
+	SharedLockGuard<T> &operator=(const SharedLockGuard<T> &&) = delete;
+
+	bool operator==(const SharedLockGuard<T> &) const = delete;
+	bool operator==(const SharedLockGuard<T> &&) const = delete;
+};
+
 #endif
@@ -1,9 +1,176 @@
 #include "map.hh"
+#include "hashmap.hh"
+#include "btree.hh"
+#include "shardedmap.hh"
+#include "persistenttree.h"
 #include <map>
+#include <set>
+#include <random>
+#include <vector>
 #include <string>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <stdexcept>
+#include <unistd.h>
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		fprintf(stderr, "Check failed: %s\n", what);
+		exit(1);
+	}
+}
+
+/// @brief Nested shared holds must not deadlock behind a writer which
+/// queued up between the outer and the inner one.
+static void checkNestedLookups() {
+	RWLock lock;
+	lock.lockShared();
+	std::thread writer([&]() {
+		lock.lock();
+		lock.unlock();
+	});
+	while (!lock.isLocked())
+		std::this_thread::yield();
+	check(lock.tryLockShared(), "Nested tryLockShared() with a waiting writer");
+	lock.lockShared();
+	lock.unlockShared();
+	lock.unlockShared();
+	lock.unlockShared();
+	writer.join();
+
+	Map<int, int> map;
+	for (int i = 0; i < 64; i++)
+		map.insert(i, i);
+
+	map.lockShared();
+	std::thread inserter([&]() { map.insert(64, 64); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	for (auto &i : map)
+		check(map.get(i.key) == i.value && map.find(i.key) != map.end(), "Nested lookups while iterating");
+	map.unlockShared();
+	inserter.join();
+	check(map.has(64), "Insert after the shared hold");
+
+	ShardedMap<int, int> shardedMap;
+	for (int i = 0; i < 256; i++)
+		shardedMap.insert(i, i);
+
+	shardedMap.lockShared();
+	std::thread shardInserter([&]() {
+		for (int i = 256; i < 512; i++)
+			shardedMap.insert(i, i);
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	for (int i = 0; i < 256; i++)
+		check(shardedMap.get(i) == i, "Nested lookups on every shard");
+	shardedMap.unlockShared();
+	shardInserter.join();
+	check(shardedMap.size() == 512, "Inserts after the shared hold of all shards");
+	printf("Nested lookups: OK\n");
+}
+
+/// @brief Snapshots of a PersistentRBTree must not change with later
+/// updates.
+static void checkSnapshots() {
+	PersistentRBTree<int> tree;
+	std::set<int> expected;
+	std::vector<std::pair<PersistentRBTree<int>::Snapshot, std::set<int>>> snapshots;
+	std::mt19937 random(1);
+
+	for (int i = 0; i < 4096; i++) {
+		int key = (int)(random() % 512);
+		if (random() % 3) {
+			tree.insertOrAssign(key);
+			expected.insert(key);
+		} else
+			check(tree.erase(key) == (expected.erase(key) != 0), "Erase from a persistent tree");
+		tree.verify();
+
+		if (i % 256 == 0)
+			snapshots.emplace_back(tree.snapshot(), expected);
+	}
+
+	for (auto &i : snapshots) {
+		check(i.first.size() == i.second.size(), "Snapshot size");
+		auto j = i.second.begin();
+		for (int key : i.first)
+			check(j != i.second.end() && key == *j++, "Snapshot contents");
+		check(j == i.second.end(), "Snapshot contents");
+	}
+	printf("Persistent tree snapshots: OK\n");
+}
+
+/// @brief Whether opening the image at `path` is rejected.
+static bool rejectsImage(const char *path) {
+	try {
+		Map<int, int>::openMapped(path);
+	} catch (std::runtime_error &) {
+		return true;
+	}
+	return false;
+}
+
+/// @brief Map images must read back the map which was saved, and damaged
+/// images must be rejected.
+static void checkMappedMap() {
+	const char *path = "map-check.img";
+	constexpr int N = 1000;
+
+	Map<int, int> map;
+	for (int i = 0; i < N; i++)
+		map.insert(2 * i, i);
+	map.save(path);
+
+	{
+		auto mapped = Map<int, int>::openMapped(path);
+		check(mapped.size() == map.size(), "Mapped size");
+		auto j = map.begin();
+		for (auto i = mapped.begin(); i != mapped.end(); ++i, ++j)
+			check(i->key == j->key && i->value == j->value, "Mapped contents");
+
+		// Every key and every gap in between, across all 64-key blocks of
+		// the index.
+		for (int key = -1; key <= 2 * N; key++) {
+			auto i = mapped.lowerBound(key);
+			if (key >= 2 * N - 1)
+				check(i == mapped.end(), "Mapped lowerBound() past the end");
+			else
+				check(i != mapped.end() && i->key == (key + 1) / 2 * 2, "Mapped lowerBound()");
+			check(mapped.has(key) == (key >= 0 && key < 2 * N && !(key & 1)), "Mapped has()");
+		}
+	}
+
+	FILE *file = fopen(path, "r+b");
+	check(file && fseek(file, 0, SEEK_END) == 0, "Open the map image");
+	long size = ftell(file);
+
+	// Corrupted magic.
+	char byte;
+	fseek(file, 0, SEEK_SET);
+	check(fread(&byte, 1, 1, file) == 1, "Read the map image");
+	byte ^= 0xff;
+	fseek(file, 0, SEEK_SET);
+	fwrite(&byte, 1, 1, file);
+	fflush(file);
+	check(rejectsImage(path), "Reject a corrupted header");
+
+	byte ^= 0xff;
+	fseek(file, 0, SEEK_SET);
+	fwrite(&byte, 1, 1, file);
+	fclose(file);
+	check(!rejectsImage(path), "Accept the repaired image");
+
+	check(truncate(path, size - 1) == 0 && rejectsImage(path), "Reject a truncated image");
+	check(truncate(path, 16) == 0 && rejectsImage(path), "Reject a truncated header");
+	remove(path);
+	printf("Mapped map images: OK\n");
+}
 
 int main() {
-	Map<int, std::string> map;
+	// Single-threaded, so there is no need for locking.
+	Map<int, std::string, PoolAllocator, false, NullLock> map;
 
 	for (int i = 0; i < 64; i++) {
 		int j = i & 1 ? i : 128 - i;
@@ -30,5 +197,38 @@ int main() {
 		// map.verify();
 	}
 
+	HashMap<int, std::string> hashMap;
+
+	for (int i = 0; i < 64; i++) {
+		int j = i & 1 ? i : 128 - i;
+		printf("Inserting into hash map: %d\n", j);
+		hashMap.insert(j, std::to_string(i));
+	}
+
+	for (int i = 0; i < 64; i += 2) {
+		int j = i & 1 ? i : 128 - i;
+		printf("Removing from hash map: %d\n", j);
+		hashMap.remove(j);
+	}
+
+	for (auto k = hashMap.begin(); k != hashMap.end(); ++k)
+		printf("%d = %s\n", k->key, k->value.c_str());
+
+	BTreeMap<int, std::string> bTreeMap;
+
+	for (int i = 0; i < 1024; i++) {
+		int j = i & 1 ? i : 2048 - i;
+		bTreeMap.insert(j, std::to_string(i));
+	}
+
+	for (int i = 0; i < 1024; i += 2)
+		bTreeMap.remove(2048 - i);
+
+	for (auto k = bTreeMap.begin(); k != bTreeMap.end(); ++k)
+		printf("B-tree: %d = %s\n", k->key, k->value.c_str());
+
+	checkNestedLookups();
+	checkSnapshots();
+	checkMappedMap();
 	return 0;
 }
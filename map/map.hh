@@ -1,17 +1,27 @@
 #ifndef __MAP_H__
 #define __MAP_H__
 
+#include <vector>
+#include <utility>
+#include <algorithm>
 #include "tree.h"
+#include "mappedmap.hh"
 
-template <typename K, typename V>
+/// @brief Ordered map on top of RBTree, RANKED enables select(), rank()
+/// and countRange() and L is the lock policy of the tree.
+template <typename K, typename V, typename A = PoolAllocator, bool RANKED = false, typename L = RWLock>
 class Map final {
 public:
 	struct Entry {
 		K key;
 		V value;
 
-		inline Entry(K key) : key(key) {}
-		inline Entry(K key, V value) : key(key), value(value) {}
+		inline Entry(K key) : key(std::move(key)) {}
+		inline Entry(K key, V value) : key(std::move(key)), value(std::move(value)) {}
+		explicit inline Entry(const std::pair<K, V> &pair) : key(pair.first), value(pair.second) {}
+
+		template <typename... Args>
+		inline Entry(std::piecewise_construct_t, const K &key, Args &&...args) : key(key), value(std::forward<Args>(args)...) {}
 
 		inline bool operator<(const Entry &rhs) const noexcept {
 			return key < rhs.key;
@@ -20,17 +30,39 @@ public:
 		inline bool operator>(const Entry &rhs) const noexcept {
 			return key > rhs.key;
 		}
+
+		// Entries are ordered against bare keys, or anything else comparable
+		// with K (e.g. std::string_view for std::string keys), for lookups.
+		template <typename U>
+		friend inline bool operator<(const Entry &lhs, const U &rhs) {
+			return lhs.key < rhs;
+		}
+
+		template <typename U>
+		friend inline bool operator<(const U &lhs, const Entry &rhs) {
+			return lhs < rhs.key;
+		}
 	};
 
 private:
-	using Tree = RBTree<Entry>;
+	using Tree = RBTree<Entry, A, RANKED, L>;
 	Tree *_tree;
 
 public:
+	using Iterator = typename Tree::Iterator;
+	/// @brief Number of keys which findBatch() looks up per lock.
+	constexpr static size_t BATCH_CHUNK = 256;
+
 	inline Map() {
 		_tree = new Tree();
 	}
 
+	/// @brief Build from a range of key-value pairs, see assign().
+	template <typename It>
+	inline Map(It first, It last) : Map() {
+		assign(first, last);
+	}
+
 	inline ~Map() {
 		delete _tree;
 	}
@@ -43,21 +75,196 @@ public:
 		return _tree->end();
 	}
 
+	/// @brief Insert an entry, or overwrite the value of an existing one.
 	inline void insert(K key, V value) {
-		if (_tree->has(key))
-			_tree->remove(key);
-		_tree->insert({ key, value });
+		insertOrAssign(key, std::move(value));
+	}
+
+	/// @brief Overwrite the value of an existing entry in place, or insert a
+	/// new one, with a single descent.
+	/// @return The iterator of the entry and whether it was inserted.
+	inline std::pair<typename Tree::Iterator, bool> insertOrAssign(const K &key, V value) {
+		auto result = _tree->upsert(
+			key, [&]() { return Entry(key, std::move(value)); },
+			[&](Entry &entry) { entry.value = std::move(value); });
+#ifndef NDEBUG
+		_tree->verify();
+#endif
+		return result;
+	}
+
+	/// @brief Insert an entry with a value constructed from `args`, unless
+	/// the key exists, in which case nothing is constructed.
+	/// @return The iterator of the entry and whether it was inserted.
+	template <typename... Args>
+	inline std::pair<typename Tree::Iterator, bool> tryEmplace(const K &key, Args &&...args) {
+		auto result = _tree->upsert(
+			key, [&]() { return Entry(std::piecewise_construct, key, std::forward<Args>(args)...); },
+			[](Entry &) {});
 #ifndef NDEBUG
 		_tree->verify();
 #endif
+		return result;
+	}
+
+	/// @brief The value of a key, default constructed if the key is missing.
+	inline V &operator[](const K &key) {
+		return tryEmplace(key).first->value;
 	}
 
-	inline void remove(K key) {
+	/// @brief Replace the contents with a range of key-value pairs which is
+	/// sorted by strictly ascending keys, in linear time.
+	template <typename It>
+	inline void assignSorted(It first, It last) {
+		_tree->assignSorted(first, last);
+#ifndef NDEBUG
+		_tree->verify();
+#endif
+	}
+
+	/// @brief Replace the contents with a range of key-value pairs in any
+	/// order. Like insert(), later values win over earlier ones for the same
+	/// key.
+	template <typename It>
+	inline void assign(It first, It last) {
+		std::vector<Entry> entries;
+		for (; first != last; ++first)
+			entries.emplace_back(first->first, first->second);
+
+		std::stable_sort(entries.begin(), entries.end());
+		auto end = std::unique(entries.rbegin(), entries.rend(), [](const Entry &lhs, const Entry &rhs) {
+			return !(rhs < lhs);
+		});
+		entries.erase(entries.begin(), end.base());
+		assignSorted(entries.begin(), entries.end());
+	}
+
+	template <typename U>
+	inline void remove(const U &key) {
 		_tree->remove(key);
 #ifndef NDEBUG
 		_tree->verify();
 #endif
 	}
+
+	/// @brief Like remove(), without throwing on a missing key.
+	/// @return Whether an entry was removed.
+	template <typename U>
+	inline bool erase(const U &key) {
+		bool erased = _tree->erase(key);
+#ifndef NDEBUG
+		_tree->verify();
+#endif
+		return erased;
+	}
+
+	/// @brief Lookups take a K or any type comparable with K, and never
+	/// copy the key or construct a value.
+	/// @return The end iterator if there is no such key.
+	template <typename U>
+	inline typename Tree::Iterator find(const U &key) {
+		return _tree->find(key);
+	}
+
+	/// @brief The first entry whose key is not less than `key`, or end().
+	template <typename U>
+	inline typename Tree::Iterator lowerBound(const U &key) {
+		return _tree->lowerBound(key);
+	}
+
+	/// @brief The first entry whose key is greater than `key`, or end().
+	template <typename U>
+	inline typename Tree::Iterator upperBound(const U &key) {
+		return _tree->upperBound(key);
+	}
+
+	template <typename U>
+	inline typename Tree::Range equalRange(const U &key) {
+		return _tree->equalRange(key);
+	}
+
+	/// @brief The entries with keys in [lo, hi), for range-based for loops.
+	template <typename U, typename W>
+	inline typename Tree::Range range(const U &lo, const W &hi) {
+		return _tree->range(lo, hi);
+	}
+
+	template <typename U>
+	inline bool contains(const U &key) {
+		return _tree->has(key);
+	}
+
+	template <typename U>
+	inline bool has(const U &key) {
+		return _tree->has(key);
+	}
+
+	template <typename U>
+	inline V &get(const U &key) {
+		auto node = _tree->get(key);
+		if (!node)
+			throw std::invalid_argument("No such entry");
+		return node->value.value;
+	}
+
+	/// @brief Look up `n` keys at once, setting out[i] to the value of
+	/// keys[i] or nullptr, see RBTree::findBatch(). Each chunk of
+	/// BATCH_CHUNK keys is looked up under one lock.
+	template <typename U>
+	inline void findBatch(const U *keys, size_t n, V **out) {
+		typename Tree::Node *nodes[BATCH_CHUNK];
+		for (size_t i = 0; i < n; i += BATCH_CHUNK) {
+			size_t m = std::min(n - i, BATCH_CHUNK);
+			_tree->findBatch(keys + i, m, nodes);
+			for (size_t j = 0; j < m; ++j)
+				out[i + j] = nodes[j] ? &nodes[j]->value.value : nullptr;
+		}
+	}
+
+	inline size_t size() const {
+		return _tree->size();
+	}
+
+	/// @brief The entry with the k-th smallest key, counting from 0.
+	/// @return The end iterator if k is not less than size().
+	inline typename Tree::Iterator select(size_t k) {
+		return _tree->select(k);
+	}
+
+	/// @brief Number of keys less than `key`.
+	template <typename U>
+	inline size_t rank(const U &key) {
+		return _tree->rank(key);
+	}
+
+	/// @brief Number of keys in [lo, hi).
+	template <typename U, typename W>
+	inline size_t countRange(const U &lo, const W &hi) {
+		return _tree->countRange(lo, hi);
+	}
+
+	/// @brief Write a sorted, pointer-free image of the map to `path`, which
+	/// openMapped() serves without rebuilding the map. K and V must be
+	/// trivially copyable, see MappedMap.
+	inline void save(const char *path) {
+		SharedLockGuard<Tree> lg(*_tree);
+		MappedMap<K, V>::write(path, _tree->begin(), _tree->end(), _tree->size());
+	}
+
+	/// @brief Serve lookups and ordered iteration straight from an image
+	/// written by save(), in place of loading it into a Map.
+	static inline MappedMap<K, V> openMapped(const char *path) {
+		return MappedMap<K, V>(path);
+	}
+
+	/// @brief Hold off writers while iterating, see RBTree::lockShared().
+	inline void lockShared() {
+		_tree->lockShared();
+	}
+
+	inline void unlockShared() {
+		_tree->unlockShared();
+	}
 };
 
 #endif
@@ -0,0 +1,379 @@
+#ifndef __MAPPEDMAP_H__
+#define __MAPPEDMAP_H__
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <optional>
+#include <stdexcept>
+#include <algorithm>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/// @brief Read-only ordered map served straight from a memory-mapped image
+/// file, as written by write() or Map::save().
+///
+/// The image is pointer-free: a fixed header, all keys in ascending order,
+/// all values in the same order and a sparse index holding every
+/// INDEX_STRIDE-th key. Opening it maps the file and checks the header, so
+/// it takes the same time for any size; pages are read in by the lookups
+/// which touch them. A lookup binary-searches the small index first and
+/// then one block of keys. K and V must be trivially copyable, and images
+/// are only readable on machines with the same byte order and type sizes.
+template <typename K, typename V>
+class MappedMap final {
+	static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+		"Map images need trivially copyable keys and values");
+	static_assert(alignof(K) <= 64 && alignof(V) <= 64, "Sections of map images are aligned to 64 bytes");
+
+public:
+	constexpr static uint32_t FORMAT_VERSION = 1;
+	constexpr static size_t INDEX_STRIDE = 64, SECTION_ALIGNMENT = 64;
+
+	struct Entry {
+		const K &key;
+		const V &value;
+	};
+
+private:
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		// Reads back differently on a machine with another byte order.
+		uint32_t byteOrder;
+		uint32_t keySize, valueSize;
+		uint64_t count;
+		uint64_t keysOffset, valuesOffset, indexOffset, indexCount;
+		uint64_t fileSize;
+	};
+
+	constexpr static char MAGIC[8] = { 'K', 'F', 'M', 'A', 'P', 'I', 'M', 'G' };
+	constexpr static uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+	void *_data = nullptr;
+	size_t _fileSize = 0;
+	const K *_keys = nullptr, *_index = nullptr;
+	const V *_values = nullptr;
+	size_t _count = 0, _indexCount = 0;
+
+	static inline uint64_t _align(uint64_t offset) {
+		return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+	}
+
+	/// @brief Section offsets of an image with `count` entries.
+	static inline Header _layout(size_t count) {
+		Header header = {};
+		memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.version = FORMAT_VERSION;
+		header.byteOrder = BYTE_ORDER_MARK;
+		header.keySize = sizeof(K);
+		header.valueSize = sizeof(V);
+		header.count = count;
+		header.indexCount = (count + INDEX_STRIDE - 1) / INDEX_STRIDE;
+		header.keysOffset = _align(sizeof(Header));
+		header.valuesOffset = _align(header.keysOffset + count * sizeof(K));
+		header.indexOffset = _align(header.valuesOffset + count * sizeof(V));
+		header.fileSize = header.indexOffset + header.indexCount * sizeof(K);
+		return header;
+	}
+
+	[[noreturn]] static inline void _fail(const char *what, const std::string &path) {
+		throw std::runtime_error(std::string(what) + " " + path + ": " + strerror(errno));
+	}
+
+	/// @brief The first position in [first, last) whose key is not less
+	/// than `key`.
+	template <typename U>
+	static inline size_t _lowerBound(const K *keys, size_t first, size_t last, const U &key) {
+		while (first < last) {
+			size_t middle = first + (last - first) / 2;
+			if (keys[middle] < key)
+				first = middle + 1;
+			else
+				last = middle;
+		}
+		return first;
+	}
+
+	template <typename U>
+	inline size_t _lowerBound(const U &key) const {
+		// The first block which starts at `key` or later. Unless it starts at
+		// `key` exactly, the result is in the block before, or right after it.
+		size_t block = _lowerBound(_index, 0, _indexCount, key);
+		if (block < _indexCount && !(key < _index[block]))
+			return block * INDEX_STRIDE;
+		if (!block)
+			return 0;
+
+		size_t first = (block - 1) * INDEX_STRIDE;
+		return _lowerBound(_keys, first, std::min(first + INDEX_STRIDE, _count), key);
+	}
+
+	template <typename U>
+	inline size_t _find(const U &key) const {
+		size_t i = _lowerBound(key);
+		if (i < _count && !(key < _keys[i]))
+			return i;
+		return _count;
+	}
+
+	inline void _unmap() {
+		if (_data)
+			munmap(_data, _fileSize);
+		_data = nullptr;
+	}
+
+public:
+	struct Iterator {
+		size_t index;
+		const MappedMap *map;
+
+		inline Iterator(size_t index, const MappedMap *map) : index(index), map(map) {}
+
+		inline Iterator &operator++() {
+			if (index >= map->_count)
+				throw std::logic_error("Increasing the end iterator");
+			++index;
+			return *this;
+		}
+
+		inline Iterator operator++(int) {
+			Iterator it = *this;
+			++(*this);
+			return it;
+		}
+
+		inline Iterator &operator--() {
+			if (!index)
+				throw std::logic_error("Decreasing the begin iterator");
+			--index;
+			return *this;
+		}
+
+		inline Iterator operator--(int) {
+			Iterator it = *this;
+			--(*this);
+			return it;
+		}
+
+		inline bool operator==(const Iterator &it) const {
+			if (map != it.map)
+				throw std::logic_error("Cannot compare iterators from different maps");
+			return index == it.index;
+		}
+
+		inline bool operator!=(const Iterator &it) const {
+			return !(*this == it);
+		}
+
+		inline Entry operator*() const {
+			if (index >= map->_count)
+				throw std::logic_error("Deferencing the end iterator");
+			return { map->_keys[index], map->_values[index] };
+		}
+
+		struct Arrow {
+			Entry entry;
+
+			inline const Entry *operator->() const { return &entry; }
+		};
+
+		inline Arrow operator->() const {
+			return { **this };
+		}
+	};
+
+	/// @brief Write an image of the `count` entries in [first, last), which
+	/// must be sorted by strictly ascending keys and provide `->key` and
+	/// `->value`. The range is traversed twice. The image is written next to
+	/// `path` and renamed over it when complete, so that a crash never leaves
+	/// a partial image behind and readers of the old one are not disturbed.
+	template <typename It>
+	static void write(const char *path, It first, It last, size_t count) {
+		Header header = _layout(count);
+		std::string tmpPath = std::string(path) + ".tmp";
+		FILE *fp = fopen(tmpPath.c_str(), "wb");
+		if (!fp)
+			_fail("Cannot create", tmpPath);
+
+		std::vector<K> index;
+		index.reserve(header.indexCount);
+		uint64_t offset = 0;
+		bool ok = true;
+
+		auto put = [&](const void *p, size_t size) {
+			ok = ok && (!size || fwrite(p, 1, size, fp) == size);
+			offset += size;
+		};
+		auto pad = [&](uint64_t to) {
+			static const char zeros[SECTION_ALIGNMENT] = {};
+			put(zeros, to - offset);
+		};
+		auto discard = [&]() {
+			int error = errno;
+			fclose(fp);
+			unlink(tmpPath.c_str());
+			errno = error;
+		};
+
+		put(&header, sizeof(header));
+		pad(header.keysOffset);
+		size_t n = 0;
+		std::optional<K> prev;
+		for (It i = first; ok && i != last && n < count; ++i, ++n) {
+			if (prev && !(*prev < i->key)) {
+				discard();
+				throw std::invalid_argument("Keys are not strictly ascending");
+			}
+			prev = i->key;
+			if (n % INDEX_STRIDE == 0)
+				index.push_back(i->key);
+			put(&i->key, sizeof(K));
+		}
+		if (ok && n != count) {
+			discard();
+			throw std::invalid_argument("Entry count does not match the range");
+		}
+
+		pad(header.valuesOffset);
+		n = 0;
+		for (It i = first; ok && n < count; ++i, ++n)
+			put(&i->value, sizeof(V));
+
+		pad(header.indexOffset);
+		put(index.data(), index.size() * sizeof(K));
+
+		ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+		if (!ok) {
+			discard();
+			_fail("Cannot write", tmpPath);
+		}
+		if (fclose(fp) != 0 || rename(tmpPath.c_str(), path) != 0) {
+			int error = errno;
+			unlink(tmpPath.c_str());
+			errno = error;
+			_fail("Cannot write", path);
+		}
+	}
+
+	inline MappedMap() = default;
+
+	/// @brief Map an image file, which must not be modified while mapped.
+	/// Replacing it through write() is safe.
+	explicit MappedMap(const char *path) {
+		int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			_fail("Cannot open", path);
+
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			int error = errno;
+			::close(fd);
+			errno = error;
+			_fail("Cannot open", path);
+		}
+
+		_fileSize = (size_t)st.st_size;
+		if (_fileSize < sizeof(Header)) {
+			::close(fd);
+			throw std::runtime_error(std::string("Invalid map image ") + path);
+		}
+
+		_data = mmap(nullptr, _fileSize, PROT_READ, MAP_SHARED, fd, 0);
+		int error = errno;
+		::close(fd);
+		if (_data == MAP_FAILED) {
+			_data = nullptr;
+			errno = error;
+			_fail("Cannot map", path);
+		}
+
+		Header header;
+		memcpy(&header, _data, sizeof(header));
+		Header expected = _layout(header.count);
+		if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) || header.version != FORMAT_VERSION ||
+			header.byteOrder != BYTE_ORDER_MARK || header.keySize != sizeof(K) || header.valueSize != sizeof(V) ||
+			header.count > _fileSize || header.keysOffset != expected.keysOffset ||
+			header.valuesOffset != expected.valuesOffset || header.indexOffset != expected.indexOffset ||
+			header.indexCount != expected.indexCount || header.fileSize != expected.fileSize ||
+			header.fileSize > _fileSize) {
+			_unmap();
+			throw std::runtime_error(std::string("Invalid map image ") + path);
+		}
+
+		const char *base = (const char *)_data;
+		_keys = (const K *)(base + header.keysOffset);
+		_values = (const V *)(base + header.valuesOffset);
+		_index = (const K *)(base + header.indexOffset);
+		_count = header.count;
+		_indexCount = header.indexCount;
+	}
+
+	inline MappedMap(MappedMap &&map) noexcept {
+		*this = std::move(map);
+	}
+
+	inline MappedMap &operator=(MappedMap &&map) noexcept {
+		if (this != &map) {
+			_unmap();
+			_data = map._data, _fileSize = map._fileSize;
+			_keys = map._keys, _values = map._values, _index = map._index;
+			_count = map._count, _indexCount = map._indexCount;
+			map._data = nullptr;
+			map._count = 0, map._indexCount = 0;
+		}
+		return *this;
+	}
+
+	MappedMap(const MappedMap &) = delete;
+	MappedMap &operator=(const MappedMap &) = delete;
+
+	inline ~MappedMap() {
+		_unmap();
+	}
+
+	inline Iterator begin() const {
+		return Iterator(0, this);
+	}
+
+	inline Iterator end() const {
+		return Iterator(_count, this);
+	}
+
+	/// @return The end iterator if there is no such key.
+	template <typename U>
+	inline Iterator find(const U &key) const {
+		return Iterator(_find(key), this);
+	}
+
+	/// @brief The first entry whose key is not less than `key`, or end().
+	template <typename U>
+	inline Iterator lowerBound(const U &key) const {
+		return Iterator(_lowerBound(key), this);
+	}
+
+	template <typename U>
+	inline bool has(const U &key) const {
+		return _find(key) != _count;
+	}
+
+	template <typename U>
+	inline const V &get(const U &key) const {
+		size_t i = _find(key);
+		if (i == _count)
+			throw std::invalid_argument("No such entry");
+		return _values[i];
+	}
+
+	inline size_t size() const {
+		return _count;
+	}
+};
+
+#endif
@@ -1,34 +1,127 @@
 #ifndef __MUTEX_H__
 #define __MUTEX_H__
 
+#include <atomic>
+#include <chrono>
 #include <thread>
+#include <cstdint>
 #include <cassert>
 #include <stdexcept>
+#include <type_traits>
 
-class Mutex final {
+#ifdef __linux__
+	#include <unistd.h>
+	#include <sys/syscall.h>
+	#include <linux/futex.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+	#include <immintrin.h>
+#endif
+
+/// @brief Lock contention counters of a BasicMutex<true>.
+struct MutexStats {
+	uint64_t nAcquisitions;
+	// Acquisitions which found the mutex locked.
+	uint64_t nContended;
+	// Total time spent waiting in contended acquisitions.
+	uint64_t waitNs;
+};
+
+/// @brief Mutex which spins for a short while and then sleeps on a futex
+/// (yields on other systems than Linux).
+///
+/// The state is 0 when unlocked, 1 when locked and 2 when locked with
+/// possible sleepers, so an unlock only enters the kernel if somebody may
+/// be sleeping (see Drepper, "Futexes Are Tricky"). With STATS, it counts
+/// acquisitions, contended acquisitions and the time spent waiting.
+template <bool STATS = false>
+class BasicMutex final {
 private:
-	bool _locked = false;
+	constexpr static uint32_t UNLOCKED = 0, LOCKED = 1, CONTENDED = 2;
+	constexpr static int SPIN_COUNT = 100;
+
+	struct Stats {
+		std::atomic<uint64_t> nAcquisitions{ 0 }, nContended{ 0 }, waitNs{ 0 };
+	};
+	struct NoStats {};
+
+	std::atomic<uint32_t> _state{ UNLOCKED };
+	[[no_unique_address]] std::conditional_t<STATS, Stats, NoStats> _stats;
 #ifndef NDEBUG
 	std::thread::id _ownerThreadId;
 #endif
 
+	static inline void _pause() {
+#if defined(__x86_64__) || defined(__i386__)
+		_mm_pause();
+#elif defined(__aarch64__)
+		asm volatile("yield");
+#endif
+	}
+
+	inline void _wait() {
+#ifdef __linux__
+		syscall(SYS_futex, (uint32_t *)&_state, FUTEX_WAIT_PRIVATE, CONTENDED, nullptr, nullptr, 0);
+#else
+		std::this_thread::yield();
+#endif
+	}
+
+	inline void _wake() {
+#ifdef __linux__
+		syscall(SYS_futex, (uint32_t *)&_state, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+	}
+
+	inline void _lockContended() {
+		for (int i = 0; i < SPIN_COUNT; ++i) {
+			_pause();
+			uint32_t expected = UNLOCKED;
+			if (_state.load(std::memory_order_relaxed) == UNLOCKED &&
+				_state.compare_exchange_weak(expected, LOCKED, std::memory_order_acquire, std::memory_order_relaxed))
+				return;
+		}
+
+		// From here on the state stays CONTENDED while we hold the lock, as
+		// there may be other sleepers to wake up.
+		while (_state.exchange(CONTENDED, std::memory_order_acquire) != UNLOCKED)
+			_wait();
+	}
+
+	inline void _release() {
+		if (_state.exchange(UNLOCKED, std::memory_order_release) == CONTENDED)
+			_wake();
+	}
+
 public:
-	Mutex() = default;
-	~Mutex() = default;
+	BasicMutex() = default;
+	~BasicMutex() = default;
 
-	Mutex(const Mutex &) = delete;
-	Mutex(const Mutex &&) = delete;
+	BasicMutex(const BasicMutex &) = delete;
+	BasicMutex(const BasicMutex &&) = delete;
 
-	Mutex &operator=(const Mutex &) = delete;
-	Mutex &operator=(const Mutex &&) = delete;
+	BasicMutex &operator=(const BasicMutex &) = delete;
+	BasicMutex &operator=(const BasicMutex &&) = delete;
 
-	bool operator==(const Mutex &) const = delete;
-	bool operator==(const Mutex &&) const = delete;
+	bool operator==(const BasicMutex &) const = delete;
+	bool operator==(const BasicMutex &&) const = delete;
 
 	inline void lock() {
-		while (_locked)
-			std::this_thread::yield();
-		_locked = true;
+		uint32_t expected = UNLOCKED;
+		if (!_state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire, std::memory_order_relaxed)) {
+			if constexpr (STATS) {
+				auto begin = std::chrono::steady_clock::now();
+				_lockContended();
+				auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+				_stats.nContended.fetch_add(1, std::memory_order_relaxed);
+				_stats.waitNs.fetch_add((uint64_t)ns, std::memory_order_relaxed);
+			} else
+				_lockContended();
+		}
+
+		if constexpr (STATS)
+			_stats.nAcquisitions.fetch_add(1, std::memory_order_relaxed);
 #ifndef NDEBUG
 		_ownerThreadId = std::this_thread::get_id();
 #endif
@@ -36,31 +129,63 @@ public:
 
 	inline void unlock() {
 #ifndef NDEBUG
-		if (!_locked)
+		if (_state.load(std::memory_order_relaxed) == UNLOCKED)
 			throw std::logic_error("Unlocking an unlocked mutex");
 		if (_ownerThreadId != std::this_thread::get_id())
 			throw std::logic_error("Unlocking a mutex which is not owned by current thread");
+		_ownerThreadId = std::thread::id();
 #endif
-		_locked = false;
+		_release();
 	}
 
 	inline bool tryLock() {
-		if (_locked)
+		uint32_t expected = UNLOCKED;
+		if (!_state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire, std::memory_order_relaxed))
 			return false;
-		return _locked = true;
+
+		if constexpr (STATS)
+			_stats.nAcquisitions.fetch_add(1, std::memory_order_relaxed);
+#ifndef NDEBUG
+		_ownerThreadId = std::this_thread::get_id();
+#endif
+		return true;
 	}
 
 	inline void tryUnlock() {
-#ifndef _NDEBUG
+#ifndef NDEBUG
 		if (_ownerThreadId != std::this_thread::get_id())
 			throw std::logic_error("Unlocking a mutex which is not owned by current thread");
+		_ownerThreadId = std::thread::id();
 #endif
-		_locked = false;
+		_release();
 	}
 
+	/// @brief Shared locking is exclusive, so that a mutex can stand in for
+	/// RWLock as a lock policy.
+	inline void lockShared() { lock(); }
+	inline bool tryLockShared() { return tryLock(); }
+	inline void unlockShared() { unlock(); }
+
 	inline bool isLocked() const {
-		return _locked;
+		return _state.load(std::memory_order_relaxed) != UNLOCKED;
+	}
+
+	inline MutexStats stats() const {
+		static_assert(STATS, "Contention counters need BasicMutex<true>");
+		return { _stats.nAcquisitions.load(std::memory_order_relaxed), _stats.nContended.load(std::memory_order_relaxed),
+			_stats.waitNs.load(std::memory_order_relaxed) };
+	}
+
+	inline void resetStats() {
+		static_assert(STATS, "Contention counters need BasicMutex<true>");
+		_stats.nAcquisitions.store(0, std::memory_order_relaxed);
+		_stats.nContended.store(0, std::memory_order_relaxed);
+		_stats.waitNs.store(0, std::memory_order_relaxed);
 	}
 };
 
+using Mutex = BasicMutex<false>;
+/// @brief Mutex with contention counters, see BasicMutex::stats().
+using ProfiledMutex = BasicMutex<true>;
+
 #endif
@@ -0,0 +1,33 @@
+#ifndef __NULLLOCK_H__
+#define __NULLLOCK_H__
+
+/// @brief Lock policy which does nothing, for containers that are only used
+/// from one thread at a time. Every method is an empty inline function, so
+/// the guards around it compile down to nothing.
+class NullLock final {
+public:
+	NullLock() = default;
+	~NullLock() = default;
+
+	NullLock(const NullLock &) = delete;
+	NullLock(const NullLock &&) = delete;
+
+	NullLock &operator=(const NullLock &) = delete;
+	NullLock &operator=(const NullLock &&) = delete;
+
+	bool operator==(const NullLock &) const = delete;
+	bool operator==(const NullLock &&) const = delete;
+
+	inline void lock() {}
+	inline void unlock() {}
+	inline bool tryLock() { return true; }
+	inline void tryUnlock() {}
+
+	inline void lockShared() {}
+	inline bool tryLockShared() { return true; }
+	inline void unlockShared() {}
+
+	inline bool isLocked() const { return false; }
+};
+
+#endif
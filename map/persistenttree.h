@@ -0,0 +1,512 @@
+#ifndef __PERSISTENTTREE_H__
+#define __PERSISTENTTREE_H__
+
+#include <cstdint>
+#include <cassert>
+#include <stdexcept>
+#include <atomic>
+#include "epoch.h"
+#include "mutex.h"
+#include "lockguard.h"
+#include "pool.h"
+
+/// @brief Persistent red-black tree (left-leaning, after Sedgewick), whose
+/// published versions are never modified.
+///
+/// An update copies the O(log n) nodes on its path and shares the rest with
+/// the previous version, then publishes the new root atomically. snapshot()
+/// returns a reference-counted read view of the current version, which can
+/// be scanned for as long as needed while writers go on. Writers are
+/// serialized by a mutex, readers never block and never block writers.
+///
+/// Nodes are reference-counted by their parents in every live version. The
+/// tree's own reference to a replaced version is dropped through Epoch, so
+/// that snapshot() and the lookups on the tree may read the current root
+/// without a lock.
+template <typename T, typename A = PoolAllocator>
+class PersistentRBTree final {
+public:
+	constexpr static bool BLACK = false, RED = true;
+
+	/// @brief Bound on the height of any tree which fits into memory, as for
+	/// a red-black tree the height is at most 2 * log2(n + 1).
+	constexpr static size_t MAX_HEIGHT = 128;
+
+	struct Node {
+		std::atomic<size_t> refs{ 1 };
+		Node *l = nullptr, *r = nullptr;
+		// The update which created the node, which may modify it in place.
+		uint64_t version;
+		T value;
+		bool color;
+
+		inline Node(T value, bool color, uint64_t version) : version(version), value(std::move(value)), color(color) {}
+	};
+
+private:
+	struct Version {
+		std::atomic<size_t> refs{ 1 };
+		Node *root;
+		size_t size;
+
+		inline Version(Node *root, size_t size) : root(root), size(size) {}
+	};
+
+	Mutex _writeLock;
+	std::atomic<Version *> _current;
+	// Number of the running update, see Node::version.
+	uint64_t _version = 0;
+
+	static inline bool _isRed(const Node *node) {
+		return node && node->color == RED;
+	}
+
+	/// @brief Drop a reference to a subtree, freeing the nodes which are not
+	/// shared with any other version.
+	static inline void _release(Node *node) {
+		// Holds at most one pending sibling per level.
+		Node *stack[MAX_HEIGHT + 1];
+		size_t depth = 0;
+		while (node) {
+			// The last reference needs no atomic decrement, nobody else can
+			// see the count any more.
+			if (node->refs.load(std::memory_order_acquire) == 1 || node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				if (node->r) {
+					assert(depth <= MAX_HEIGHT);
+					stack[depth++] = node->r;
+				}
+				Node *l = node->l;
+				A::destroy(node);
+				node = l;
+				if (node)
+					continue;
+			}
+
+			node = depth ? stack[--depth] : nullptr;
+		}
+	}
+
+	static inline void _release(Version *version) {
+		if (version->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			_release(version->root);
+			delete version;
+		}
+	}
+
+	static inline void _releaseRetired(void *p) {
+		_release((Version *)p);
+	}
+
+	/// @brief The node in a writable state: nodes of the running update are
+	/// modified in place, others are copied. The caller's reference, held
+	/// by a parent of the running update, moves over to the copy.
+	inline Node *_mutable(Node *node) {
+		if (node->version == _version)
+			return node;
+
+		Node *copy = A::template create<Node>(node->value, node->color, _version);
+		copy->l = node->l;
+		copy->r = node->r;
+		if (copy->l)
+			copy->l->refs.fetch_add(1, std::memory_order_relaxed);
+		if (copy->r)
+			copy->r->refs.fetch_add(1, std::memory_order_relaxed);
+		_release(node);
+		return copy;
+	}
+
+	// The rotations and flips below expect `h` to be writable already.
+
+	inline Node *_lRot(Node *h) {
+		Node *x = _mutable(h->r);
+		h->r = x->l;
+		x->l = h;
+		x->color = h->color;
+		h->color = RED;
+		return x;
+	}
+
+	inline Node *_rRot(Node *h) {
+		Node *x = _mutable(h->l);
+		h->l = x->r;
+		x->r = h;
+		x->color = h->color;
+		h->color = RED;
+		return x;
+	}
+
+	inline void _flip(Node *h) {
+		h->color = !h->color;
+		h->l = _mutable(h->l);
+		h->l->color = !h->l->color;
+		h->r = _mutable(h->r);
+		h->r->color = !h->r->color;
+	}
+
+	inline Node *_fixUp(Node *h) {
+		if (_isRed(h->r) && !_isRed(h->l))
+			h = _lRot(h);
+		if (_isRed(h->l) && _isRed(h->l->l))
+			h = _rRot(h);
+		if (_isRed(h->l) && _isRed(h->r))
+			_flip(h);
+		return h;
+	}
+
+	inline Node *_moveRedLeft(Node *h) {
+		_flip(h);
+		if (_isRed(h->r->l)) {
+			h->r = _rRot(h->r);
+			h = _lRot(h);
+			_flip(h);
+		}
+		return h;
+	}
+
+	inline Node *_moveRedRight(Node *h) {
+		_flip(h);
+		if (_isRed(h->l->l)) {
+			h = _rRot(h);
+			_flip(h);
+		}
+		return h;
+	}
+
+	/// @return The new subtree, `inserted` tells whether the value was new
+	/// or has replaced an equal one.
+	inline Node *_insert(Node *h, T &value, bool &inserted) {
+		if (!h) {
+			inserted = true;
+			return A::template create<Node>(std::move(value), RED, _version);
+		}
+
+		h = _mutable(h);
+		if (value < h->value)
+			h->l = _insert(h->l, value, inserted);
+		else if (h->value < value)
+			h->r = _insert(h->r, value, inserted);
+		else {
+			h->value = std::move(value);
+			inserted = false;
+		}
+		return _fixUp(h);
+	}
+
+	inline Node *_eraseMin(Node *h) {
+		if (!h->l) {
+			_release(h);
+			return nullptr;
+		}
+
+		if (!_isRed(h->l) && !_isRed(h->l->l))
+			h = _moveRedLeft(h);
+		h->l = _eraseMin(_mutable(h->l));
+		return _fixUp(h);
+	}
+
+	/// @brief Remove a value which is known to exist from the writable
+	/// subtree `h`.
+	template <typename U>
+	inline Node *_erase(Node *h, const U &key) {
+		if (key < h->value) {
+			if (!_isRed(h->l) && !_isRed(h->l->l))
+				h = _moveRedLeft(h);
+			h->l = _erase(_mutable(h->l), key);
+		} else {
+			if (_isRed(h->l))
+				h = _rRot(h);
+			if (!(h->value < key) && !h->r) {
+				// A left-leaning node without right child has no children.
+				_release(h);
+				return nullptr;
+			}
+			if (!_isRed(h->r) && !_isRed(h->r->l))
+				h = _moveRedRight(h);
+			if (!(h->value < key)) {
+				Node *min = h->r;
+				while (min->l)
+					min = min->l;
+				h->value = min->value;
+				h->r = _eraseMin(_mutable(h->r));
+			} else
+				h->r = _erase(_mutable(h->r), key);
+		}
+		return _fixUp(h);
+	}
+
+	template <typename U>
+	static inline Node *_get(Node *i, const U &key) {
+		while (i) {
+			if (key < i->value)
+				i = i->l;
+			else if (i->value < key)
+				i = i->r;
+			else
+				return i;
+		}
+		return nullptr;
+	}
+
+	/// @brief Start an update on a new reference to the current root.
+	inline Node *_beginUpdate(Version *current) {
+		++_version;
+		if (!current->root)
+			return nullptr;
+		current->root->refs.fetch_add(1, std::memory_order_relaxed);
+		return _mutable(current->root);
+	}
+
+	inline void _publish(Version *current, Node *root, size_t size) {
+		if (root)
+			root->color = BLACK;
+		_current.store(new Version(root, size), std::memory_order_release);
+		Epoch::retire(current, _releaseRetired);
+	}
+
+	static inline size_t _verify(const Node *node, const Node *lo, const Node *hi) {
+		if (!node)
+			return 1;
+
+		if (node->refs.load(std::memory_order_relaxed) == 0)
+			throw std::logic_error("Unreferenced node detected");
+		if (_isRed(node->r))
+			throw std::logic_error("Right-leaning red node detected");
+		if (_isRed(node) && _isRed(node->l))
+			throw std::logic_error("Red node with red child detected");
+		if ((lo && !(lo->value < node->value)) || (hi && !(node->value < hi->value)))
+			throw std::logic_error("Misordered node detected");
+
+		size_t nBlack = _verify(node->l, lo, node);
+		if (nBlack != _verify(node->r, node, hi))
+			throw std::logic_error("Unbalanced black height detected");
+		return nBlack + (_isRed(node) ? 0 : 1);
+	}
+
+public:
+	/// @brief Immutable view of one version of the tree, which keeps all
+	/// of its nodes alive. Copying it is cheap.
+	class Snapshot final {
+	private:
+		Version *_version = nullptr;
+
+		friend class PersistentRBTree;
+
+		inline explicit Snapshot(Version *version) : _version(version) {}
+
+	public:
+		/// @brief In-order iterator, which keeps its path from the root on a
+		/// stack as the nodes have no parent pointers.
+		struct Iterator {
+			const Node *stack[MAX_HEIGHT];
+			size_t depth = 0;
+
+			inline Iterator() = default;
+
+			inline void pushLeft(const Node *node) {
+				for (; node; node = node->l) {
+					assert(depth < MAX_HEIGHT);
+					stack[depth++] = node;
+				}
+			}
+
+			inline Iterator &operator++() {
+				if (!depth)
+					throw std::logic_error("Increasing the end iterator");
+				pushLeft(stack[--depth]->r);
+				return *this;
+			}
+
+			inline bool operator==(const Iterator &it) const {
+				return (depth ? stack[depth - 1] : nullptr) == (it.depth ? it.stack[it.depth - 1] : nullptr);
+			}
+
+			inline bool operator!=(const Iterator &it) const {
+				return !(*this == it);
+			}
+
+			inline const T &operator*() const {
+				if (!depth)
+					throw std::logic_error("Deferencing the end iterator");
+				return stack[depth - 1]->value;
+			}
+
+			inline const T *operator->() const {
+				return &**this;
+			}
+		};
+
+		inline Snapshot() = default;
+
+		inline Snapshot(const Snapshot &snapshot) : _version(snapshot._version) {
+			if (_version)
+				_version->refs.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		inline Snapshot(Snapshot &&snapshot) noexcept : _version(snapshot._version) {
+			snapshot._version = nullptr;
+		}
+
+		inline Snapshot &operator=(Snapshot snapshot) noexcept {
+			std::swap(_version, snapshot._version);
+			return *this;
+		}
+
+		inline ~Snapshot() {
+			if (_version)
+				_release(_version);
+		}
+
+		inline Iterator begin() const {
+			Iterator it;
+			if (_version)
+				it.pushLeft(_version->root);
+			return it;
+		}
+
+		inline Iterator end() const {
+			return Iterator();
+		}
+
+		/// @brief The first value which is not less than `key`, or end().
+		template <typename U>
+		inline Iterator lowerBound(const U &key) const {
+			// Keep exactly the nodes at which the descent turned left, which
+			// are the ones still to be visited.
+			Iterator it;
+			for (const Node *i = _version ? _version->root : nullptr; i;) {
+				if (i->value < key)
+					i = i->r;
+				else {
+					assert(it.depth < MAX_HEIGHT);
+					it.stack[it.depth++] = i;
+					i = i->l;
+				}
+			}
+			return it;
+		}
+
+		template <typename U>
+		inline bool has(const U &key) const {
+			return _version && _get(_version->root, key);
+		}
+
+		template <typename U>
+		inline const T &get(const U &key) const {
+			const Node *node = _version ? _get(_version->root, key) : nullptr;
+			if (!node)
+				throw std::invalid_argument("No such entry");
+			return node->value;
+		}
+
+		inline size_t size() const {
+			return _version ? _version->size : 0;
+		}
+	};
+
+	inline PersistentRBTree() : _current(new Version(nullptr, 0)) {}
+
+	PersistentRBTree(const PersistentRBTree &) = delete;
+	PersistentRBTree &operator=(const PersistentRBTree &) = delete;
+
+	/// @brief Must not run concurrently with any other operation on the
+	/// tree, snapshots may outlive it.
+	inline ~PersistentRBTree() {
+		_release(_current.load(std::memory_order_relaxed));
+	}
+
+	/// @brief A read view of the current version, which is not affected by
+	/// later updates.
+	inline Snapshot snapshot() {
+		Epoch::Guard guard;
+		Version *version = _current.load(std::memory_order_acquire);
+		version->refs.fetch_add(1, std::memory_order_relaxed);
+		return Snapshot(version);
+	}
+
+	inline void insert(T value) {
+		LockGuard<Mutex> lg(_writeLock);
+		Version *current = _current.load(std::memory_order_relaxed);
+		if (_get(current->root, value))
+			throw std::runtime_error("Entry exists");
+
+		bool inserted;
+		Node *root = _insert(_beginUpdate(current), value, inserted);
+		_publish(current, root, current->size + 1);
+	}
+
+	/// @brief Insert a value, or replace the one which is ordered equal.
+	/// @return Whether the value was inserted.
+	inline bool insertOrAssign(T value) {
+		LockGuard<Mutex> lg(_writeLock);
+		Version *current = _current.load(std::memory_order_relaxed);
+
+		bool inserted;
+		Node *root = _insert(_beginUpdate(current), value, inserted);
+		_publish(current, root, current->size + inserted);
+		return inserted;
+	}
+
+	/// @return Whether a value was removed.
+	template <typename U>
+	inline bool erase(const U &key) {
+		LockGuard<Mutex> lg(_writeLock);
+		Version *current = _current.load(std::memory_order_relaxed);
+		if (!_get(current->root, key))
+			return false;
+
+		Node *root = _beginUpdate(current);
+		if (!_isRed(root->l) && !_isRed(root->r))
+			root->color = RED;
+		_publish(current, _erase(root, key), current->size - 1);
+		return true;
+	}
+
+	template <typename U>
+	inline void remove(const U &key) {
+		if (!erase(key))
+			throw std::invalid_argument("No such entry");
+	}
+
+	inline void clear() {
+		LockGuard<Mutex> lg(_writeLock);
+		_publish(_current.load(std::memory_order_relaxed), nullptr, 0);
+	}
+
+	template <typename U>
+	inline bool has(const U &key) {
+		Epoch::Guard guard;
+		return _get(_current.load(std::memory_order_acquire)->root, key) != nullptr;
+	}
+
+	/// @brief A copy of the value ordered equal to `key`, as the current
+	/// version may be replaced right after the lookup.
+	template <typename U>
+	inline T get(const U &key) {
+		Epoch::Guard guard;
+		Node *node = _get(_current.load(std::memory_order_acquire)->root, key);
+		if (!node)
+			throw std::invalid_argument("No such entry");
+		return node->value;
+	}
+
+	inline size_t size() {
+		Epoch::Guard guard;
+		return _current.load(std::memory_order_acquire)->size;
+	}
+
+	inline void verify() {
+		Snapshot s = snapshot();
+		Node *root = s._version->root;
+		if (_isRed(root))
+			throw std::logic_error("Red root node detected");
+		_verify(root, nullptr, nullptr);
+
+		size_t n = 0;
+		for (auto i = s.begin(); i != s.end(); ++i)
+			++n;
+		if (n != s.size())
+			throw std::logic_error("Wrong node count detected");
+	}
+};
+
+#endif
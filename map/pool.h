@@ -0,0 +1,188 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <mutex>
+#include <utility>
+
+/// @brief Thread-local pool of small blocks, grouped into size classes.
+///
+/// Each thread carves blocks out of its own chunks and recycles freed blocks
+/// through per-class free lists, so allocation and deallocation never touch
+/// a lock on the fast path. A block may be freed by any thread, it simply
+/// joins the free list of the thread which frees it. Free lists of exiting
+/// threads are parked in a global depot and adopted by other threads.
+/// Chunks are never returned to the system.
+class SizeClassPool final {
+public:
+	constexpr static size_t GRANULARITY = 16, MAX_SIZE = 256, CHUNK_SIZE = 64 * 1024;
+
+private:
+	constexpr static size_t N_CLASSES = MAX_SIZE / GRANULARITY;
+
+	struct FreeBlock {
+		FreeBlock *next;
+	};
+
+	struct Depot {
+		std::mutex mutex;
+		FreeBlock *freeLists[N_CLASSES] = {};
+	};
+
+	FreeBlock *_freeLists[N_CLASSES] = {};
+	char *_cur[N_CLASSES] = {}, *_end[N_CLASSES] = {};
+
+	static inline Depot &_depot() {
+		static Depot depot;
+		return depot;
+	}
+
+	static inline size_t _classOf(size_t size) {
+		return (size + GRANULARITY - 1) / GRANULARITY - 1;
+	}
+
+	static inline size_t _blockSize(size_t sizeClass) {
+		return (sizeClass + 1) * GRANULARITY;
+	}
+
+	inline void *_refill(size_t sizeClass) {
+		{
+			Depot &depot = _depot();
+			std::lock_guard<std::mutex> lg(depot.mutex);
+			if (depot.freeLists[sizeClass]) {
+				FreeBlock *block = depot.freeLists[sizeClass];
+				depot.freeLists[sizeClass] = block->next;
+				_freeLists[sizeClass] = depot.freeLists[sizeClass];
+				depot.freeLists[sizeClass] = nullptr;
+				return block;
+			}
+		}
+
+		char *chunk = (char *)::operator new(CHUNK_SIZE, std::align_val_t(GRANULARITY));
+		_cur[sizeClass] = chunk + _blockSize(sizeClass);
+		_end[sizeClass] = chunk + CHUNK_SIZE / _blockSize(sizeClass) * _blockSize(sizeClass);
+		return chunk;
+	}
+
+public:
+	SizeClassPool() = default;
+	SizeClassPool(const SizeClassPool &) = delete;
+	SizeClassPool &operator=(const SizeClassPool &) = delete;
+
+	/// @brief Park all free blocks of this pool in the depot.
+	inline void donate() {
+		Depot &depot = _depot();
+		std::lock_guard<std::mutex> lg(depot.mutex);
+
+		for (size_t i = 0; i < N_CLASSES; ++i) {
+			FreeBlock *list = _freeLists[i];
+
+			// Hand the untouched tail of the current chunk over as well.
+			for (char *j = _cur[i]; j != _end[i]; j += _blockSize(i)) {
+				FreeBlock *block = (FreeBlock *)j;
+				block->next = list;
+				list = block;
+			}
+
+			while (list) {
+				FreeBlock *next = list->next;
+				list->next = depot.freeLists[i];
+				depot.freeLists[i] = list;
+				list = next;
+			}
+
+			_freeLists[i] = nullptr;
+			_cur[i] = _end[i] = nullptr;
+		}
+	}
+
+	static inline SizeClassPool &local() {
+		// The pool itself is trivially destructible, so containers destroyed
+		// after the thread-local destructors (e.g. globals) can still use it.
+		struct Reaper {
+			inline ~Reaper() { local().donate(); }
+		};
+
+		thread_local SizeClassPool pool;
+		thread_local Reaper reaper;
+		(void)reaper;
+		return pool;
+	}
+
+	inline void *allocate(size_t size) {
+		if (size > MAX_SIZE)
+			return ::operator new(size);
+
+		size_t sizeClass = _classOf(size);
+		if (FreeBlock *block = _freeLists[sizeClass]) {
+			_freeLists[sizeClass] = block->next;
+			return block;
+		}
+
+		if (_cur[sizeClass] != _end[sizeClass]) {
+			void *p = _cur[sizeClass];
+			_cur[sizeClass] += _blockSize(sizeClass);
+			return p;
+		}
+
+		return _refill(sizeClass);
+	}
+
+	inline void deallocate(void *p, size_t size) {
+		if (size > MAX_SIZE) {
+			::operator delete(p);
+			return;
+		}
+
+		size_t sizeClass = _classOf(size);
+		FreeBlock *block = (FreeBlock *)p;
+		block->next = _freeLists[sizeClass];
+		_freeLists[sizeClass] = block;
+	}
+};
+
+/// @brief Node allocator policy backed by the thread-local SizeClassPool.
+struct PoolAllocator {
+	template <typename U, typename... Args>
+	static inline U *create(Args &&...args) {
+		if constexpr (alignof(U) > SizeClassPool::GRANULARITY) {
+			return new U(std::forward<Args>(args)...);
+		} else {
+			SizeClassPool &pool = SizeClassPool::local();
+			void *p = pool.allocate(sizeof(U));
+			try {
+				return new (p) U(std::forward<Args>(args)...);
+			} catch (...) {
+				pool.deallocate(p, sizeof(U));
+				throw;
+			}
+		}
+	}
+
+	template <typename U>
+	static inline void destroy(U *p) {
+		if constexpr (alignof(U) > SizeClassPool::GRANULARITY) {
+			delete p;
+		} else {
+			p->~U();
+			SizeClassPool::local().deallocate(p, sizeof(U));
+		}
+	}
+};
+
+/// @brief Node allocator policy using the global heap.
+struct NewAllocator {
+	template <typename U, typename... Args>
+	static inline U *create(Args &&...args) {
+		return new U(std::forward<Args>(args)...);
+	}
+
+	template <typename U>
+	static inline void destroy(U *p) {
+		delete p;
+	}
+};
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef __RWLOCK_H__
+#define __RWLOCK_H__
+
+#include <atomic>
+#include <thread>
+#include <cstddef>
+#include <stdexcept>
+
+/// @brief Reader/writer lock with writer preference.
+///
+/// Readers only touch a per-thread reader slot that sits on its own cache
+/// line, so concurrent readers never write to a shared cache line. A writer
+/// raises the writer flag, which turns new readers away, and then waits for
+/// every reader slot to drain.
+///
+/// The read side is reentrant: a thread which already holds the lock shared
+/// gets in again even while a writer is waiting, as the writer cannot pass
+/// the outer hold anyway. Up to N_HELD_LOCKS locks are tracked per thread,
+/// shared holds of further locks are not reentrant.
+class RWLock final {
+private:
+	constexpr static size_t N_READER_SLOTS = 32, CACHE_LINE_SIZE = 64, N_HELD_LOCKS = 16;
+
+	struct Held {
+		const RWLock *lock;
+		size_t depth;
+	};
+
+	struct alignas(CACHE_LINE_SIZE) ReaderSlot {
+		std::atomic<size_t> count{ 0 };
+	};
+
+	ReaderSlot _readers[N_READER_SLOTS];
+	alignas(CACHE_LINE_SIZE) std::atomic<bool> _writing{ false };
+
+	static inline std::atomic<size_t> &_readerSlot(RWLock *lock) {
+		static std::atomic<size_t> nThreads{ 0 };
+		thread_local size_t slotIndex = nThreads.fetch_add(1, std::memory_order_relaxed) % N_READER_SLOTS;
+		return lock->_readers[slotIndex].count;
+	}
+
+	/// @brief The shared holds of the calling thread, the entry of `lock`
+	/// or nullptr if there is none.
+	static inline Held *_held(const RWLock *lock) {
+		thread_local Held held[N_HELD_LOCKS] = {};
+		for (auto &i : held) {
+			if (i.lock == lock)
+				return &i;
+		}
+		return nullptr;
+	}
+
+	/// @brief Count a new shared hold, the outermost one gets an entry if
+	/// there is a free one.
+	inline void _enterShared() {
+		if (Held *held = _held(nullptr)) {
+			held->lock = this;
+			held->depth = 1;
+		}
+	}
+
+public:
+	RWLock() = default;
+	~RWLock() = default;
+
+	RWLock(const RWLock &) = delete;
+	RWLock(const RWLock &&) = delete;
+
+	RWLock &operator=(const RWLock &) = delete;
+	RWLock &operator=(const RWLock &&) = delete;
+
+	inline void lockShared() {
+		auto &slot = _readerSlot(this);
+		if (Held *held = _held(this)) {
+			// Our own hold already keeps writers out.
+			++held->depth;
+			slot.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		for (;;) {
+			// Publishing the reader before checking the writer flag (and the
+			// writer doing the opposite) guarantees that at least one of both
+			// sides sees the other.
+			slot.fetch_add(1, std::memory_order_seq_cst);
+			if (!_writing.load(std::memory_order_seq_cst)) {
+				_enterShared();
+				return;
+			}
+
+			// Back off so that a waiting writer is not starved.
+			slot.fetch_sub(1, std::memory_order_release);
+			while (_writing.load(std::memory_order_relaxed))
+				std::this_thread::yield();
+		}
+	}
+
+	inline bool tryLockShared() {
+		auto &slot = _readerSlot(this);
+		if (Held *held = _held(this)) {
+			++held->depth;
+			slot.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		slot.fetch_add(1, std::memory_order_seq_cst);
+		if (!_writing.load(std::memory_order_seq_cst)) {
+			_enterShared();
+			return true;
+		}
+		slot.fetch_sub(1, std::memory_order_release);
+		return false;
+	}
+
+	inline void unlockShared() {
+		if (Held *held = _held(this)) {
+			if (!--held->depth)
+				held->lock = nullptr;
+		}
+		_readerSlot(this).fetch_sub(1, std::memory_order_release);
+	}
+
+	inline void lock() {
+		bool expected = false;
+		while (!_writing.compare_exchange_weak(expected, true, std::memory_order_seq_cst)) {
+			expected = false;
+			std::this_thread::yield();
+		}
+
+		for (auto &i : _readers) {
+			while (i.count.load(std::memory_order_seq_cst))
+				std::this_thread::yield();
+		}
+	}
+
+	inline bool tryLock() {
+		bool expected = false;
+		if (!_writing.compare_exchange_strong(expected, true, std::memory_order_seq_cst))
+			return false;
+
+		for (auto &i : _readers) {
+			if (i.count.load(std::memory_order_seq_cst)) {
+				_writing.store(false, std::memory_order_release);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	inline void unlock() {
+#ifndef NDEBUG
+		if (!_writing.load(std::memory_order_relaxed))
+			throw std::logic_error("Unlocking an unlocked lock");
+#endif
+		_writing.store(false, std::memory_order_release);
+	}
+
+	inline void tryUnlock() {
+		_writing.store(false, std::memory_order_release);
+	}
+
+	inline bool isLocked() const {
+		return _writing.load(std::memory_order_relaxed);
+	}
+};
+
+#endif
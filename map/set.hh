@@ -4,8 +4,9 @@
 #include <cassert>
 #include <stdexcept>
 #include <iostream>
+#include "pool.h"
 
-template <typename K, typename V>
+template <typename K, typename V, typename A = PoolAllocator>
 class Set {
 protected:
 	enum class Color : bool {
@@ -24,13 +25,6 @@ protected:
 		inline Node(K key) : key(key) {}
 		inline Node(K key, V value) : key(key), value(value) {}
 
-		inline ~Node() {
-			if (l)
-				delete l;
-			if (r)
-				delete r;
-		}
-
 		inline Node *getMinNode() {
 			Node *i = this;
 			if (i->l)
@@ -48,6 +42,27 @@ protected:
 
 	Node *_root = nullptr;
 
+	/// @brief Free a whole subtree without recursion.
+	static inline void _destroy(Node *node) {
+		while (node) {
+			if (node->l)
+				node = node->l;
+			else if (node->r)
+				node = node->r;
+			else {
+				Node *p = node->p;
+				if (p) {
+					if (p->l == node)
+						p->l = nullptr;
+					else
+						p->r = nullptr;
+				}
+				A::destroy(node);
+				node = p;
+			}
+		}
+	}
+
 	inline bool _isRed(Node *node) { return node && node->color == Color::RED; }
 	inline bool _isBlack(Node *node) { return (!node) || node->color == Color::BLACK; }
 
@@ -204,8 +219,8 @@ protected:
 	}
 
 public:
-	virtual inline ~Map() {
-		delete _root;
+	virtual inline ~Set() {
+		_destroy(_root);
 	}
 
 	inline void verify() {
@@ -361,9 +376,7 @@ public:
 		}
 
 		// Free the node.
-		node->l = nullptr;
-		node->r = nullptr;
-		delete node;
+		A::destroy(node);
 	}
 
 	inline bool has(K key) {
@@ -375,7 +388,7 @@ public:
 		if (node)
 			return node->value;
 
-		node = new Node(key);
+		node = A::template create<Node>(key);
 		_insert(node);
 		return node->value;
 	}
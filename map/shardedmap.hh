@@ -0,0 +1,158 @@
+#ifndef __SHARDEDMAP_H__
+#define __SHARDEDMAP_H__
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <algorithm>
+#include "map.hh"
+
+/// @brief Map split into SHARDS independent Maps by the hash of the keys,
+/// each with its own tree and lock, so that writers on different shards do
+/// not contend. Iteration visits all shards in key order by a k-way merge.
+template <typename K, typename V, size_t SHARDS = 16, typename H = std::hash<K>, typename A = PoolAllocator>
+class ShardedMap final {
+	static_assert(SHARDS && !(SHARDS & (SHARDS - 1)), "The number of shards must be a power of two");
+
+public:
+	using Shard = Map<K, V, A>;
+	using Entry = typename Shard::Entry;
+
+private:
+	// Each Map only holds a pointer to its tree, the lock and the nodes
+	// which writers contend on live in separately allocated trees.
+	Shard _shards[SHARDS];
+	H _hasher;
+
+	inline Shard &_shard(const K &key) {
+		// Spread the bits like HashMap does, std::hash is the identity for
+		// integers.
+		uint64_t x = (uint64_t)_hasher(key) * 0x9e3779b97f4a7c15ull;
+		return _shards[(x >> 32) & (SHARDS - 1)];
+	}
+
+public:
+	/// @brief Forward iterator merging the iterators of all shards, always
+	/// positioned at the smallest key among them.
+	struct Iterator {
+		struct Cursor {
+			typename Shard::Iterator cur, end;
+		};
+
+		std::vector<Cursor> heap;
+
+		static inline bool _greater(const Cursor &lhs, const Cursor &rhs) {
+			return rhs.cur->key < lhs.cur->key;
+		}
+
+		inline Iterator &operator++() {
+			if (heap.empty())
+				throw std::logic_error("Increasing the end iterator");
+
+			std::pop_heap(heap.begin(), heap.end(), _greater);
+			if (++heap.back().cur != heap.back().end)
+				std::push_heap(heap.begin(), heap.end(), _greater);
+			else
+				heap.pop_back();
+			return *this;
+		}
+
+		inline bool operator==(const Iterator &it) const {
+			if (heap.empty() || it.heap.empty())
+				return heap.empty() == it.heap.empty();
+			// Positioned at the same node, which may be on different shards.
+			return heap.front().cur.node == it.heap.front().cur.node;
+		}
+
+		inline bool operator!=(const Iterator &it) const {
+			return !(*this == it);
+		}
+
+		inline Entry &operator*() {
+			if (heap.empty())
+				throw std::logic_error("Deferencing the end iterator");
+			return *heap.front().cur;
+		}
+
+		inline Entry *operator->() {
+			return &**this;
+		}
+	};
+
+	ShardedMap() = default;
+	ShardedMap(const ShardedMap &) = delete;
+	ShardedMap &operator=(const ShardedMap &) = delete;
+
+	Iterator begin() {
+		Iterator it;
+		for (auto &i : _shards) {
+			if (i.begin() != i.end())
+				it.heap.push_back({ i.begin(), i.end() });
+		}
+		std::make_heap(it.heap.begin(), it.heap.end(), Iterator::_greater);
+		return it;
+	}
+
+	Iterator end() {
+		return Iterator();
+	}
+
+	inline void insert(K key, V value) {
+		_shard(key).insert(key, std::move(value));
+	}
+
+	inline std::pair<typename Shard::Iterator, bool> insertOrAssign(const K &key, V value) {
+		return _shard(key).insertOrAssign(key, std::move(value));
+	}
+
+	template <typename... Args>
+	inline std::pair<typename Shard::Iterator, bool> tryEmplace(const K &key, Args &&...args) {
+		return _shard(key).tryEmplace(key, std::forward<Args>(args)...);
+	}
+
+	inline V &operator[](const K &key) {
+		return _shard(key)[key];
+	}
+
+	inline void remove(const K &key) {
+		_shard(key).remove(key);
+	}
+
+	inline bool erase(const K &key) {
+		return _shard(key).erase(key);
+	}
+
+	inline bool has(const K &key) {
+		return _shard(key).has(key);
+	}
+
+	inline bool contains(const K &key) {
+		return _shard(key).contains(key);
+	}
+
+	inline V &get(const K &key) {
+		return _shard(key).get(key);
+	}
+
+	/// @brief Sum of the shard sizes, exact only without concurrent writers.
+	inline size_t size() const {
+		size_t n = 0;
+		for (auto &i : _shards)
+			n += i.size();
+		return n;
+	}
+
+	/// @brief Hold off the writers of all shards, e.g. while iterating.
+	/// Lookups may be nested inside for up to 16 shards, see RWLock.
+	inline void lockShared() {
+		for (auto &i : _shards)
+			i.lockShared();
+	}
+
+	inline void unlockShared() {
+		for (auto &i : _shards)
+			i.unlockShared();
+	}
+};
+
+#endif
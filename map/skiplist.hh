@@ -0,0 +1,409 @@
+#ifndef __SKIPLIST_H__
+#define __SKIPLIST_H__
+
+#include <cstdint>
+#include <cassert>
+#include <stdexcept>
+#include <atomic>
+#include <new>
+#include "epoch.h"
+#include "pool.h"
+
+/// @brief Lock-free ordered map as a skip list.
+///
+/// Writers link and unlink nodes with CAS, lookups never write to shared
+/// memory, and unlinked nodes and replaced values are reclaimed through
+/// Epoch. Every operation may run concurrently with any other, iterators
+/// included. Unlike Map, values are returned by copy and insert() replaces
+/// the value of an existing entry with a new copy, so that readers never
+/// see a value which is being written.
+///
+/// Removal follows Herlihy and Shavit: a node is first marked on each of
+/// its levels, top-down, and belongs to the remover which marks level 0.
+/// Marked nodes are unlinked by whichever thread comes across them.
+template <typename K, typename V>
+class SkipListMap final {
+public:
+	constexpr static int MAX_LEVEL = 20;
+
+private:
+	using Link = std::atomic<uintptr_t>;
+
+	struct Node {
+		// Bits of `state`, the node is retired by whichever of the inserter
+		// and the remover finishes last, see _finish().
+		constexpr static uint8_t LINKED = 1, UNLINKED = 2;
+
+		K key;
+		std::atomic<V *> value;
+		std::atomic<uint8_t> state{ 0 };
+		int height;
+
+		inline Node(const K &key, V *value, int height) : key(key), value(value), height(height) {
+			for (int i = 0; i < height; ++i)
+				new (&next()[i]) Link(0);
+		}
+
+		inline ~Node() {
+			delete value.load(std::memory_order_relaxed);
+		}
+
+		inline Link *next() {
+			return (Link *)(this + 1);
+		}
+	};
+
+	static_assert(alignof(Node) >= alignof(Link), "Links must be aligned");
+
+	Node *_head;
+	std::atomic<size_t> _size{ 0 };
+
+	static inline bool _isMarked(uintptr_t link) { return link & 1; }
+	static inline Node *_ptr(uintptr_t link) { return (Node *)(link & ~(uintptr_t)1); }
+
+	static inline Node *_createNode(const K &key, V *value, int height) {
+		void *p = SizeClassPool::local().allocate(sizeof(Node) + height * sizeof(Link));
+		return new (p) Node(key, value, height);
+	}
+
+	static inline void _destroyNode(void *p) {
+		Node *node = (Node *)p;
+		size_t size = sizeof(Node) + node->height * sizeof(Link);
+		node->~Node();
+		SizeClassPool::local().deallocate(node, size);
+	}
+
+	static inline int _randomHeight() {
+		// Each level holds a quarter of the nodes of the level below.
+		thread_local uint64_t state = 0x9e3779b97f4a7c15ull ^ (uint64_t)(uintptr_t)&state;
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		int height = 1 + __builtin_ctzll(state | (1ull << 62)) / 2;
+		return height < MAX_LEVEL ? height : MAX_LEVEL;
+	}
+
+	/// @brief Find the predecessors and successors of `key` on every level,
+	/// unlinking marked nodes on the way.
+	/// @return Whether succs[0] holds the key.
+	inline bool _find(const K &key, Node **preds, Node **succs) {
+	retry:
+		Node *pred = _head;
+		for (int level = MAX_LEVEL - 1; level >= 0; --level) {
+			Node *curr = _ptr(pred->next()[level].load(std::memory_order_acquire));
+			while (curr) {
+				uintptr_t succ = curr->next()[level].load(std::memory_order_acquire);
+				if (_isMarked(succ)) {
+					uintptr_t expected = (uintptr_t)curr;
+					if (!pred->next()[level].compare_exchange_strong(expected, succ & ~(uintptr_t)1))
+						goto retry;
+					curr = _ptr(succ);
+				} else if (curr->key < key) {
+					pred = curr;
+					curr = _ptr(succ);
+				} else
+					break;
+			}
+			preds[level] = pred;
+			succs[level] = curr;
+		}
+		return succs[0] && !(key < succs[0]->key);
+	}
+
+	/// @brief Like _find(), without writing to shared memory.
+	/// @return The unmarked node of `key`, or nullptr.
+	inline Node *_get(const K &key) const {
+		Node *pred = _head, *curr = nullptr;
+		for (int level = MAX_LEVEL - 1; level >= 0; --level) {
+			curr = _ptr(pred->next()[level].load(std::memory_order_acquire));
+			while (curr) {
+				uintptr_t succ = curr->next()[level].load(std::memory_order_acquire);
+				if (_isMarked(succ))
+					curr = _ptr(succ);
+				else if (curr->key < key) {
+					pred = curr;
+					curr = _ptr(succ);
+				} else
+					break;
+			}
+		}
+		if (curr && !(key < curr->key))
+			return curr;
+		return nullptr;
+	}
+
+	/// @brief The inserter or remover of a node is done with it. A node may
+	/// be linked into upper levels after its remover has unlinked it, so it
+	/// is retired only when both are done.
+	static inline void _finish(Node *node, uint8_t bit) {
+		if (node->state.fetch_or(bit) == (Node::LINKED | Node::UNLINKED) - bit)
+			Epoch::retire(node, _destroyNode);
+	}
+
+	/// @brief The first unmarked node from `link` on, on level 0.
+	static inline Node *_skipMarked(uintptr_t link) {
+		Node *node = _ptr(link);
+		while (node && _isMarked(node->next()[0].load(std::memory_order_acquire)))
+			node = _ptr(node->next()[0].load(std::memory_order_acquire));
+		return node;
+	}
+
+	/// @return The node if `key` was inserted, nullptr if it exists.
+	inline Node *_insert(const K &key, V *value) {
+		Node *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+		int height = _randomHeight();
+		Node *node = nullptr;
+
+		for (;;) {
+			if (_find(key, preds, succs)) {
+				if (node) {
+					node->value.store(nullptr, std::memory_order_relaxed);
+					_destroyNode(node);
+				}
+				return nullptr;
+			}
+
+			if (!node)
+				node = _createNode(key, value, height);
+			for (int i = 0; i < height; ++i)
+				node->next()[i].store((uintptr_t)succs[i], std::memory_order_relaxed);
+
+			uintptr_t expected = (uintptr_t)succs[0];
+			if (preds[0]->next()[0].compare_exchange_strong(expected, (uintptr_t)node))
+				break;
+		}
+		_size.fetch_add(1, std::memory_order_relaxed);
+
+		for (int level = 1; level < height; ++level) {
+			for (;;) {
+				uintptr_t link = node->next()[level].load();
+				if (_isMarked(link))
+					goto done;
+				// Point at the latest successor, unless a remover got here first.
+				if (_ptr(link) != succs[level] && !node->next()[level].compare_exchange_strong(link, (uintptr_t)succs[level]))
+					goto done;
+
+				uintptr_t expected = (uintptr_t)succs[level];
+				if (preds[level]->next()[level].compare_exchange_strong(expected, (uintptr_t)node))
+					break;
+
+				if (!_find(key, preds, succs) || succs[0] != node)
+					goto done;
+			}
+		}
+
+	done:
+		// A remover may have unlinked the node before the upper levels above
+		// were linked, take them out again.
+		if (_isMarked(node->next()[0].load()))
+			_find(key, preds, succs);
+		_finish(node, Node::LINKED);
+		return node;
+	}
+
+public:
+	/// @brief Reference to an entry, valid until the iterator moves.
+	struct Entry {
+		const K &key;
+		const V &value;
+	};
+
+	/// @brief Weakly consistent forward iterator: entries inserted or
+	/// removed during the iteration may or may not be visited. It pins the
+	/// epoch while it is not at the end, so it must stay on its thread.
+	struct Iterator {
+		Node *node;
+		SkipListMap *map;
+
+		inline Iterator(Node *node, SkipListMap *map) : node(node), map(map) {
+			if (node)
+				Epoch::enter();
+		}
+
+		inline Iterator(const Iterator &it) : Iterator(it.node, it.map) {}
+
+		inline ~Iterator() {
+			if (node)
+				Epoch::leave();
+		}
+
+		inline Iterator &operator=(const Iterator &rhs) {
+			if (rhs.node)
+				Epoch::enter();
+			if (node)
+				Epoch::leave();
+			node = rhs.node;
+			map = rhs.map;
+			return *this;
+		}
+
+		inline Iterator &operator++() {
+			if (!node)
+				throw std::logic_error("Increasing the end iterator");
+
+			node = _skipMarked(node->next()[0].load(std::memory_order_acquire));
+			if (!node)
+				Epoch::leave();
+			return *this;
+		}
+
+		inline bool operator==(const Iterator &it) const {
+			if (map != it.map)
+				throw std::logic_error("Cannot compare iterators from different maps");
+			return node == it.node;
+		}
+
+		inline bool operator!=(const Iterator &it) const {
+			return !(*this == it);
+		}
+
+		inline Entry operator*() const {
+			if (!node)
+				throw std::logic_error("Deferencing the end iterator");
+			return { node->key, *node->value.load(std::memory_order_acquire) };
+		}
+
+		struct Arrow {
+			Entry entry;
+
+			inline const Entry *operator->() const { return &entry; }
+		};
+
+		inline Arrow operator->() const {
+			return { **this };
+		}
+	};
+
+	inline SkipListMap() {
+		void *p = ::operator new(sizeof(Node) + MAX_LEVEL * sizeof(Link));
+		_head = new (p) Node(K(), nullptr, MAX_LEVEL);
+	}
+
+	SkipListMap(const SkipListMap &) = delete;
+	SkipListMap &operator=(const SkipListMap &) = delete;
+
+	/// @brief Must not run concurrently with any other operation.
+	inline ~SkipListMap() {
+		// Nodes which are still linked on level 0 have not been retired.
+		Node *i = _ptr(_head->next()[0].load());
+		while (i) {
+			Node *next = _ptr(i->next()[0].load());
+			_destroyNode(i);
+			i = next;
+		}
+		_head->~Node();
+		::operator delete(_head);
+	}
+
+	Iterator begin() {
+		Epoch::Guard guard;
+		return Iterator(_skipMarked(_head->next()[0].load(std::memory_order_acquire)), this);
+	}
+
+	Iterator end() {
+		return Iterator(nullptr, this);
+	}
+
+	/// @brief Insert an entry, or replace the value of an existing one.
+	/// @return Whether the entry was inserted.
+	inline bool insert(const K &key, const V &value) {
+		Epoch::Guard guard;
+		V *v = new V(value);
+
+		for (;;) {
+			if (_insert(key, v))
+				return true;
+
+			Node *node = _get(key);
+			if (node) {
+				if (V *old = node->value.exchange(v))
+					Epoch::retire(old);
+				return false;
+			}
+			// Removed in the meantime, try inserting again.
+		}
+	}
+
+	/// @brief Insert an entry unless the key exists.
+	/// @return Whether the entry was inserted.
+	inline bool tryInsert(const K &key, const V &value) {
+		Epoch::Guard guard;
+		V *v = new V(value);
+
+		if (_insert(key, v))
+			return true;
+		delete v;
+		return false;
+	}
+
+	/// @return Whether an entry was removed.
+	inline bool erase(const K &key) {
+		Epoch::Guard guard;
+		Node *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+
+		if (!_find(key, preds, succs))
+			return false;
+		Node *node = succs[0];
+
+		for (int level = node->height - 1; level > 0; --level) {
+			uintptr_t link = node->next()[level].load();
+			while (!_isMarked(link))
+				node->next()[level].compare_exchange_weak(link, link | 1);
+		}
+
+		uintptr_t link = node->next()[0].load();
+		for (;;) {
+			if (_isMarked(link))
+				// Another thread removed it first.
+				return false;
+			if (node->next()[0].compare_exchange_weak(link, link | 1))
+				break;
+		}
+
+		_size.fetch_sub(1, std::memory_order_relaxed);
+		_find(key, preds, succs);
+		_finish(node, Node::UNLINKED);
+		return true;
+	}
+
+	inline void remove(const K &key) {
+		if (!erase(key))
+			throw std::invalid_argument("No such entry");
+	}
+
+	inline bool has(const K &key) {
+		Epoch::Guard guard;
+		return _get(key) != nullptr;
+	}
+
+	inline bool contains(const K &key) {
+		return has(key);
+	}
+
+	inline V get(const K &key) {
+		Epoch::Guard guard;
+		Node *node = _get(key);
+		if (!node)
+			throw std::invalid_argument("No such entry");
+		return *node->value.load(std::memory_order_acquire);
+	}
+
+	/// @brief Copy the value of `key` into `value`.
+	/// @return Whether the key exists.
+	inline bool tryGet(const K &key, V &value) {
+		Epoch::Guard guard;
+		Node *node = _get(key);
+		if (!node)
+			return false;
+		value = *node->value.load(std::memory_order_acquire);
+		return true;
+	}
+
+	/// @brief Number of entries, exact only while there are no concurrent
+	/// writers.
+	inline size_t size() const {
+		return _size.load(std::memory_order_relaxed);
+	}
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef __SPINLOCK_H__
+#define __SPINLOCK_H__
+
+#include <atomic>
+#include <thread>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+	#include <immintrin.h>
+#endif
+
+/// @brief Test-and-test-and-set spin lock for very short critical sections.
+/// Waiters spin on a plain load, so that the cache line is only written
+/// when the lock looks free, and yield after a while. Shared locking is
+/// exclusive, so that it can stand in for RWLock as a lock policy.
+class SpinLock final {
+private:
+	constexpr static int SPIN_COUNT = 100;
+
+	std::atomic<bool> _locked{ false };
+
+	static inline void _pause() {
+#if defined(__x86_64__) || defined(__i386__)
+		_mm_pause();
+#elif defined(__aarch64__)
+		asm volatile("yield");
+#endif
+	}
+
+public:
+	SpinLock() = default;
+	~SpinLock() = default;
+
+	SpinLock(const SpinLock &) = delete;
+	SpinLock(const SpinLock &&) = delete;
+
+	SpinLock &operator=(const SpinLock &) = delete;
+	SpinLock &operator=(const SpinLock &&) = delete;
+
+	bool operator==(const SpinLock &) const = delete;
+	bool operator==(const SpinLock &&) const = delete;
+
+	inline void lock() {
+		while (_locked.exchange(true, std::memory_order_acquire)) {
+			for (int i = 0; _locked.load(std::memory_order_relaxed); ++i) {
+				if (i < SPIN_COUNT)
+					_pause();
+				else
+					std::this_thread::yield();
+			}
+		}
+	}
+
+	inline bool tryLock() {
+		return !_locked.load(std::memory_order_relaxed) && !_locked.exchange(true, std::memory_order_acquire);
+	}
+
+	inline void unlock() {
+#ifndef NDEBUG
+		if (!_locked.load(std::memory_order_relaxed))
+			throw std::logic_error("Unlocking an unlocked lock");
+#endif
+		_locked.store(false, std::memory_order_release);
+	}
+
+	inline void tryUnlock() {
+		_locked.store(false, std::memory_order_release);
+	}
+
+	inline void lockShared() { lock(); }
+	inline bool tryLockShared() { return tryLock(); }
+	inline void unlockShared() { tryUnlock(); }
+
+	inline bool isLocked() const {
+		return _locked.load(std::memory_order_relaxed);
+	}
+};
+
+#endif
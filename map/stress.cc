@@ -0,0 +1,165 @@
+#include "skiplist.hh"
+#include "concurrenthashmap.hh"
+#include <map>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <random>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+// Concurrent stress checks of the lock-free containers. Every writer thread
+// owns the keys which are congruent to its index modulo the number of
+// writers and mirrors its updates in a sequential reference map, so that the
+// final contents can be compared exactly.
+
+constexpr int N_WRITERS = 4, N_OPS = 100000, N_KEYS = 4096;
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		fprintf(stderr, "Check failed: %s\n", what);
+		exit(1);
+	}
+}
+
+/// @brief Inserts and erases on SkipListMap while other threads iterate.
+static void stressSkipList() {
+	SkipListMap<int, std::string> map;
+	std::map<int, std::string> references[N_WRITERS];
+	std::atomic<int> nRunning{ N_WRITERS };
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < N_WRITERS; t++) {
+		threads.emplace_back([&, t]() {
+			std::mt19937 random(t);
+			auto &reference = references[t];
+			for (int i = 0; i < N_OPS; i++) {
+				int key = (int)(random() % (N_KEYS / N_WRITERS)) * N_WRITERS + t;
+				if (random() % 3) {
+					std::string value = std::to_string(i);
+					check(map.insert(key, value) == !reference.count(key), "Skip list insert");
+					reference[key] = value;
+				} else
+					check(map.erase(key) == (reference.erase(key) != 0), "Skip list erase");
+			}
+			nRunning.fetch_sub(1, std::memory_order_release);
+		});
+	}
+
+	for (int t = 0; t < 2; t++) {
+		threads.emplace_back([&]() {
+			while (nRunning.load(std::memory_order_acquire)) {
+				int previous = -1;
+				for (auto i = map.begin(); i != map.end(); ++i) {
+					check(i->key > previous, "Skip list iteration order");
+					check(!i->value.empty(), "Skip list iteration value");
+					previous = i->key;
+				}
+			}
+		});
+	}
+
+	for (auto &i : threads)
+		i.join();
+
+	std::map<int, std::string> reference;
+	for (auto &i : references)
+		reference.insert(i.begin(), i.end());
+
+	check(map.size() == reference.size(), "Skip list size");
+	auto j = reference.begin();
+	for (auto i = map.begin(); i != map.end(); ++i, ++j)
+		check(j != reference.end() && i->key == j->first && i->value == j->second, "Skip list contents");
+	check(j == reference.end(), "Skip list contents");
+
+	Epoch::collect();
+	printf("Skip list: OK\n");
+}
+
+/// @brief Writers on ConcurrentHashMap which grow it through several
+/// resizes, while readers look up keys which are never removed.
+static void stressHashMap() {
+	// Stable keys are negative, so they never collide with writer keys.
+	constexpr int N_STABLE = 1000, N_GROWING_KEYS = 64 * N_KEYS;
+
+	ConcurrentHashMap<int, long> map;
+	for (int i = 1; i <= N_STABLE; i++)
+		map.insert(-i, 2L * i);
+	size_t initialBuckets = map.bucketCount();
+
+	std::map<int, long> references[N_WRITERS];
+	std::atomic<int> nRunning{ N_WRITERS };
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < N_WRITERS; t++) {
+		threads.emplace_back([&, t]() {
+			std::mt19937 random(t);
+			auto &reference = references[t];
+			for (int i = 0; i < N_OPS; i++) {
+				// The key range widens over time, so that the map keeps growing.
+				int range = (int)((N_KEYS + (int64_t)N_GROWING_KEYS * i / N_OPS) / N_WRITERS);
+				int key = (int)(random() % range) * N_WRITERS + t;
+				switch (random() % 4) {
+				case 0:
+					check(map.insert(key, i) == !reference.count(key), "Hash map insert");
+					reference[key] = i;
+					break;
+				case 1:
+					check(map.tryInsert(key, i) == reference.emplace(key, i).second, "Hash map tryInsert");
+					break;
+				case 2:
+					check(map.upsert(key, [](long &value) { value += 1; }) == !reference.count(key), "Hash map upsert");
+					reference[key] += 1;
+					break;
+				default:
+					if (random() % 2)
+						check(map.erase(key) == (reference.erase(key) != 0), "Hash map erase");
+					break;
+				}
+			}
+			nRunning.fetch_sub(1, std::memory_order_release);
+		});
+	}
+
+	for (int t = 0; t < 2; t++) {
+		threads.emplace_back([&]() {
+			while (nRunning.load(std::memory_order_acquire)) {
+				for (int i = 1; i <= N_STABLE; i++)
+					check(map.get(-i) == 2L * i, "Hash map get while resizing");
+			}
+		});
+	}
+
+	for (auto &i : threads)
+		i.join();
+
+	std::map<int, long> reference;
+	for (auto &i : references)
+		reference.insert(i.begin(), i.end());
+	for (int i = 1; i <= N_STABLE; i++)
+		reference.emplace(-i, 2L * i);
+
+	check(map.bucketCount() >= 16 * initialBuckets, "Hash map resized several times");
+	check(map.size() == reference.size(), "Hash map size");
+
+	size_t n = 0;
+	map.forEach([&](const int &key, const long &value) {
+		auto i = reference.find(key);
+		check(i != reference.end() && i->second == value, "Hash map forEach contents");
+		n++;
+	});
+	check(n == map.size(), "Hash map forEach count");
+
+	for (auto &i : reference)
+		check(map.get(i.first) == i.second, "Hash map get after resizing");
+
+	Epoch::collect();
+	printf("Concurrent hash map: OK (%zu buckets)\n", map.bucketCount());
+}
+
+int main() {
+	stressSkipList();
+	stressHashMap();
+	return 0;
+}
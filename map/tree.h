@@ -5,33 +5,42 @@
 #include <stdexcept>
 #include <iostream>
 #include <algorithm>
-#include "mutex.h"
+#include <vector>
+#include <type_traits>
+#include "rwlock.h"
+#include "nulllock.h"
 #include "lockguard.h"
-
-template <typename T>
+#include "pool.h"
+
+/// @brief Red-black tree. With RANKED, every node also counts the nodes of
+/// its subtree, which allows select(), rank() and countRange() in O(log n).
+///
+/// L is the lock policy: RWLock (the default), Mutex, SpinLock, or NullLock
+/// for trees which are only used from one thread at a time.
+template <typename T, typename A = PoolAllocator, bool RANKED = false, typename L = RWLock>
 class RBTree {
 public:
 	constexpr static bool BLACK = false, RED = true;
+	/// @brief Number of lookups which findBatch() keeps in flight.
+	constexpr static size_t BATCH_WIDTH = 16;
+
+	struct SubtreeSize {
+		size_t size = 1;
+	};
+	struct NoSubtreeSize {};
 
-	struct Node {
+	struct Node : std::conditional_t<RANKED, SubtreeSize, NoSubtreeSize> {
 		Node *p = nullptr, *l = nullptr, *r = nullptr;
 		T value;
 		bool color;
 
 		inline Node() = default;
 		inline Node(const Node &node) = default;
-		inline Node(T value) : value(value) {}
-
-		inline ~Node() {
-			if (l)
-				delete l;
-			if (r)
-				delete r;
-		}
+		inline Node(T value) : value(std::move(value)) {}
 	};
 
 private:
-	Mutex _mutex;
+	[[no_unique_address]] L _lock;
 	Node *_root = nullptr;
 	Node *_cachedMinNode = nullptr, *_cachedMaxNode = nullptr;
 	size_t _nNodes = 0;
@@ -54,6 +63,58 @@ private:
 		return node;
 	}
 
+	/// @brief The in-order successor, or nullptr after the last node.
+	static inline Node *_next(Node *node) {
+		if (node->r)
+			return _getMinNode(node->r);
+
+		while (node->p && node == node->p->r)
+			node = node->p;
+		return node->p;
+	}
+
+	/// @brief The in-order predecessor, or nullptr before the first node.
+	static inline Node *_prev(Node *node) {
+		if (node->l)
+			return _getMaxNode(node->l);
+
+		while (node->p && node == node->p->l)
+			node = node->p;
+		return node->p;
+	}
+
+	/// @brief Free a whole subtree without recursion, so that deep trees
+	/// cannot overflow the stack.
+	static inline void _destroy(Node *node) {
+		while (node) {
+			if (node->l)
+				node = node->l;
+			else if (node->r)
+				node = node->r;
+			else {
+				Node *p = node->p;
+				if (p) {
+					if (p->l == node)
+						p->l = nullptr;
+					else
+						p->r = nullptr;
+				}
+				A::destroy(node);
+				node = p;
+			}
+		}
+	}
+
+	static inline size_t _size(Node *node) {
+		static_assert(RANKED, "Subtree sizes are only kept by ranked trees");
+		return node ? node->size : 0;
+	}
+
+	static inline void _updateSize(Node *node) {
+		if constexpr (RANKED)
+			node->size = _size(node->l) + _size(node->r) + 1;
+	}
+
 	static inline bool _isRed(Node *node) { return node && node->color == RED; }
 	static inline bool _isBlack(Node *node) { return (!node) || node->color == BLACK; }
 
@@ -76,6 +137,9 @@ private:
 
 		y->l = x;
 		x->p = y;
+
+		_updateSize(x);
+		_updateSize(y);
 	}
 
 	inline void _rRot(Node *x) {
@@ -96,14 +160,20 @@ private:
 
 		y->r = x;
 		x->p = y;
+
+		_updateSize(x);
+		_updateSize(y);
 	}
 
-	inline Node *_get(T value) {
+	/// @brief Look up by anything which is ordered against T with `<` both
+	/// ways, so that callers need not build a whole T for the lookup.
+	template <typename U>
+	inline Node *_get(const U &key) {
 		Node *i = _root;
 		while (i) {
-			if (i->value < value)
+			if (i->value < key)
 				i = i->r;
-			else if (i->value > value)
+			else if (key < i->value)
 				i = i->l;
 			else
 				return i;
@@ -111,6 +181,53 @@ private:
 		return nullptr;
 	}
 
+	/// @brief _get() for many keys at once. Up to BATCH_WIDTH descents are
+	/// in flight and advanced in turns, each prefetching the next node it
+	/// will visit, so that their cache misses overlap instead of following
+	/// one another. A finished descent hands its place to the next key.
+	template <typename U>
+	inline void _getBatch(const U *keys, size_t n, Node **out) {
+		Node *nodes[BATCH_WIDTH];
+		size_t indices[BATCH_WIDTH], nActive = 0, next = 0;
+
+		for (; nActive < BATCH_WIDTH && next < n; ++nActive, ++next) {
+			nodes[nActive] = _root;
+			indices[nActive] = next;
+		}
+
+		while (nActive) {
+			for (size_t s = 0; s < nActive;) {
+				Node *i = nodes[s];
+				const U &key = keys[indices[s]];
+				bool found = false;
+				if (i) {
+					if (i->value < key)
+						i = i->r;
+					else if (key < i->value)
+						i = i->l;
+					else
+						found = true;
+				}
+
+				if (i && !found) {
+					__builtin_prefetch(i);
+					nodes[s++] = i;
+					continue;
+				}
+
+				out[indices[s]] = i;
+				if (next < n) {
+					nodes[s] = _root;
+					indices[s++] = next++;
+				} else {
+					--nActive;
+					nodes[s] = nodes[nActive];
+					indices[s] = indices[nActive];
+				}
+			}
+		}
+	}
+
 	inline void _insertFixUp(Node *node) {
 		Node *p, *gp = node, *u;  // Parent, grandparent and uncle
 
@@ -159,46 +276,57 @@ private:
 		_root->color = BLACK;
 	}
 
-	inline void _insert(Node *node) {
-		assert(!node->l);
-		assert(!node->r);
-
-		if (!_root) {
+	/// @brief Link a new node below `p`, which was found by a descent.
+	inline void _link(Node *node, Node *p, bool left) {
+		// A new minimum can only be linked left of the old one, and likewise
+		// for the maximum.
+		if (!p) {
 			_root = node;
 			node->color = BLACK;
-			goto updateNodeCaches;
-		}
-
-		{
-			Node *x = _root, *y = nullptr;
-			while (x) {
-				y = x;
-
-				if (x->value > node->value)
-					x = x->l;
-				else if (x->value < node->value)
-					x = x->r;
-				else
-					throw std::runtime_error("Entry exists");
-			}
+			_cachedMinNode = _cachedMaxNode = node;
+		} else {
+			if (left && p == _cachedMinNode)
+				_cachedMinNode = node;
+			else if (!left && p == _cachedMaxNode)
+				_cachedMaxNode = node;
 
-			if (node->value < y->value)
-				y->l = node;
+			if (left)
+				p->l = node;
 			else
-				y->r = node;
-			node->p = y;
+				p->r = node;
+			node->p = p;
 			node->color = RED;
 
+			if constexpr (RANKED) {
+				for (Node *i = p; i; i = i->p)
+					++i->size;
+			}
+
 			_insertFixUp(node);
 		}
 
-	updateNodeCaches:
-		_cachedMinNode = _getMinNode(_root);
-		_cachedMaxNode = _getMaxNode(_root);
-
 		++_nNodes;
 	}
 
+	inline void _insert(Node *node) {
+		assert(!node->l);
+		assert(!node->r);
+
+		Node *x = _root, *y = nullptr;
+		while (x) {
+			y = x;
+
+			if (x->value > node->value)
+				x = x->l;
+			else if (x->value < node->value)
+				x = x->r;
+			else
+				throw std::runtime_error("Entry exists");
+		}
+
+		_link(node, y, y && node->value < y->value);
+	}
+
 	inline Node *_removeFixUp(Node *node) {
 		// Originally adopted from SGI STL's stl_tree, with minor improvements.
 		Node *y = node, *x, *p;
@@ -215,6 +343,12 @@ private:
 			x = y->r;
 		}
 
+		if constexpr (RANKED) {
+			// y is the node which leaves its place in the tree.
+			for (Node *i = y->p; i; i = i->p)
+				--i->size;
+		}
+
 		if (y != node) {
 			node->l->p = y;
 			y->l = node->l;
@@ -238,6 +372,8 @@ private:
 
 			y->p = node->p;
 			std::swap(y->color, node->color);
+			if constexpr (RANKED)
+				y->size = node->size;
 			y = node;
 		} else {
 			p = y->p;
@@ -322,17 +458,80 @@ private:
 	}
 
 	inline void _remove(Node *node) {
-		auto y = _removeFixUp(node);
-		y->r = nullptr; 
-		y->l = nullptr;
-		delete y;
+		// The neighbours of the minimum and maximum are at most a step or two
+		// away, the rebalancing below never changes the order.
+		if (node == _cachedMinNode)
+			_cachedMinNode = _next(node);
+		if (node == _cachedMaxNode)
+			_cachedMaxNode = _prev(node);
 
-		_cachedMinNode = _getMinNode(_root);
-		_cachedMaxNode = _getMaxNode(_root);
+		auto y = _removeFixUp(node);
+		A::destroy(y);
 
 		--_nNodes;
 	}
 
+	/// @brief Link sorted nodes into a perfectly balanced subtree. Nodes on
+	/// the deepest level of the whole tree, which may be incomplete, are red
+	/// and all others black, so every path has the same number of black
+	/// nodes.
+	static inline Node *_build(Node **nodes, size_t n, Node *p, size_t depth, size_t redDepth) {
+		if (!n)
+			return nullptr;
+
+		size_t mid = n / 2;
+		Node *node = nodes[mid];
+		node->p = p;
+		node->color = depth && depth == redDepth ? RED : BLACK;
+		node->l = _build(nodes, mid, node, depth + 1, redDepth);
+		node->r = _build(nodes + mid + 1, n - mid - 1, node, depth + 1, redDepth);
+		if constexpr (RANKED)
+			node->size = n;
+		return node;
+	}
+
+	template <typename U>
+	inline size_t _rank(const U &key) {
+		size_t n = 0;
+		for (Node *i = _root; i;) {
+			if (i->value < key) {
+				n += _size(i->l) + 1;
+				i = i->r;
+			} else
+				i = i->l;
+		}
+		return n;
+	}
+
+	/// @brief The first node which is not less than `key`.
+	template <typename U>
+	inline Node *_lowerBound(const U &key) {
+		Node *i = _root, *bound = nullptr;
+		while (i) {
+			if (i->value < key)
+				i = i->r;
+			else {
+				bound = i;
+				i = i->l;
+			}
+		}
+		return bound;
+	}
+
+	/// @brief The first node which is greater than `key`.
+	template <typename U>
+	inline Node *_upperBound(const U &key) {
+		Node *i = _root, *bound = nullptr;
+		while (i) {
+			if (key < i->value) {
+				bound = i;
+				i = i->l;
+			} else
+				i = i->r;
+		}
+		return bound;
+	}
+
 	inline void _verify(Node *node, const size_t nBlack, size_t cntBlack) {
 		if (!node) {
 			// We have reached a terminal node.
@@ -347,6 +546,11 @@ private:
 		if (_isBlack(node))
 			++cntBlack;
 
+		if constexpr (RANKED) {
+			if (node->size != _size(node->l) + _size(node->r) + 1)
+				throw std::logic_error("Wrong subtree size detected");
+		}
+
 		_verify(node->l, nBlack, cntBlack);
 		_verify(node->r, nBlack, cntBlack);
 	}
@@ -376,17 +580,7 @@ public:
 			if (!node)
 				throw std::logic_error("Increasing the end iterator");
 
-			if (node != tree->_cachedMaxNode) {
-				if (node->r) {
-					node = _getMinNode(node->r);
-				} else {
-					while (node->p && (node == node->p->r))
-						node = node->p;
-					node = node->p;
-				}
-			} else {
-				node = nullptr;
-			}
+			node = node != tree->_cachedMaxNode ? _next(node) : nullptr;
 
 			return *this;
 		}
@@ -401,17 +595,7 @@ public:
 			if (node == tree->_cachedMinNode)
 				throw std::logic_error("Dereasing the begin iterator");
 
-			if (!node)
-				node = tree->_cachedMaxNode;
-			else {
-				if (node->l) {
-					node = _getMaxNode(node->l);
-				} else {
-					while (node->p && (node == node->p->l))
-						node = node->p;
-					node = node->p;
-				}
-			}
+			node = node ? _prev(node) : tree->_cachedMaxNode;
 
 			return *this;
 		}
@@ -477,6 +661,15 @@ public:
 		}
 	};
 
+	/// @brief A pair of iterators, which can be used in range-based for
+	/// loops.
+	struct Range {
+		Iterator first, last;
+
+		inline Iterator begin() const { return first; }
+		inline Iterator end() const { return last; }
+	};
+
 	Iterator begin() {
 		return Iterator(_cachedMinNode, this);
 	}
@@ -485,49 +678,185 @@ public:
 		return Iterator(nullptr, this);
 	}
 
+	/// @brief The first value which is not less than `key`, or end().
+	template <typename U>
+	inline Iterator lowerBound(const U &key) {
+		SharedLockGuard<L> lg(_lock);
+		return Iterator(_lowerBound(key), this);
+	}
+
+	/// @brief The first value which is greater than `key`, or end().
+	template <typename U>
+	inline Iterator upperBound(const U &key) {
+		SharedLockGuard<L> lg(_lock);
+		return Iterator(_upperBound(key), this);
+	}
+
+	/// @brief The values which are ordered equal to `key`.
+	template <typename U>
+	inline Range equalRange(const U &key) {
+		SharedLockGuard<L> lg(_lock);
+		return { Iterator(_lowerBound(key), this), Iterator(_upperBound(key), this) };
+	}
+
+	/// @brief The values in [lo, hi), found in O(log n) so that scanning
+	/// them costs O(log n + k).
+	template <typename U, typename W>
+	inline Range range(const U &lo, const W &hi) {
+		SharedLockGuard<L> lg(_lock);
+
+		Node *first = _lowerBound(lo), *last = _lowerBound(hi);
+		if (!first || !(first->value < hi))
+			first = last;
+		return { Iterator(first, this), Iterator(last, this) };
+	}
+
 	virtual inline ~RBTree() {
-		delete _root;
+		_destroy(_root);
+	}
+
+	template <typename U>
+	inline Node *get(const U &key) {
+		SharedLockGuard<L> lg(_lock);
+
+		return _get(key);
+	}
+
+	/// @return The end iterator if there is no such value.
+	template <typename U>
+	inline Iterator find(const U &key) {
+		SharedLockGuard<L> lg(_lock);
+
+		return Iterator(_get(key), this);
 	}
 
-	inline Node *get(T value) {
-		LockGuard<Mutex> lg(_mutex);
+	/// @brief Look up `n` keys under one lock, setting out[i] to the node
+	/// of keys[i] or nullptr. Overlaps the cache misses of the lookups, so
+	/// it beats a loop of get() on trees which do not fit into the caches.
+	template <typename U>
+	inline void findBatch(const U *keys, size_t n, Node **out) {
+		SharedLockGuard<L> lg(_lock);
 
-		return _get(value);
+		_getBatch(keys, n, out);
 	}
 
+	/// @brief Link a node into the tree, the node must have been created
+	/// with the allocator of the tree.
 	inline void insert(Node *node) {
-		LockGuard<Mutex> lg(_mutex);
+		LockGuard<L> lg(_lock);
 
 		_insert(node);
 	}
 
 	inline void insert(T value) {
-		insert(new Node(value));
+		Node *node = A::template create<Node>(value);
+		try {
+			insert(node);
+		} catch (...) {
+			A::destroy(node);
+			throw;
+		}
+	}
+
+	/// @brief Find the value ordered equal to `key`, or insert one, within a
+	/// single descent: `assign(value)` is called on an existing value, and
+	/// a missing one is built by `make()`. Both run under the write lock.
+	/// @return The iterator of the value and whether it was inserted.
+	template <typename U, typename F, typename G>
+	inline std::pair<Iterator, bool> upsert(const U &key, F &&make, G &&assign) {
+		LockGuard<L> lg(_lock);
+
+		Node *i = _root, *p = nullptr;
+		bool left = false;
+		while (i) {
+			p = i;
+			if (i->value < key) {
+				i = i->r;
+				left = false;
+			} else if (key < i->value) {
+				i = i->l;
+				left = true;
+			} else {
+				assign(i->value);
+				return { Iterator(i, this), false };
+			}
+		}
+
+		Node *node = A::template create<Node>(make());
+		_link(node, p, left);
+		return { Iterator(node, this), true };
 	}
 
 	inline void remove(Node *node) {
-		LockGuard<Mutex> lg(_mutex);
+		LockGuard<L> lg(_lock);
 
 		_remove(node);
 	}
 
-	inline void remove(T value) {
-		LockGuard<Mutex> lg(_mutex);
+	template <typename U>
+	inline void remove(const U &key) {
+		if (!erase(key))
+			throw std::invalid_argument("No such entry");
+	}
+
+	/// @brief Like remove(), without throwing on a missing value.
+	/// @return Whether a value was removed.
+	template <typename U>
+	inline bool erase(const U &key) {
+		LockGuard<L> lg(_lock);
 
-		Node *node = _get(value);
+		Node *node = _get(key);
 		if (!node)
-			throw std::invalid_argument("No such entry");
+			return false;
 
 		_remove(node);
+		return true;
 	}
 
-	inline bool has(T value) {
-		LockGuard<Mutex> lg(_mutex);
-		return _get(value) != nullptr;
+	/// @brief Replace the contents with values from a strictly ascending
+	/// range in linear time, without any comparisons against the old tree
+	/// or rebalancing.
+	template <typename It>
+	inline void assignSorted(It first, It last) {
+		std::vector<Node *> nodes;
+		try {
+			for (; first != last; ++first) {
+				nodes.push_back(nullptr);
+				nodes.back() = A::template create<Node>(T(*first));
+				if (nodes.size() > 1 && !(nodes[nodes.size() - 2]->value < nodes.back()->value))
+					throw std::invalid_argument("Values are not strictly ascending");
+			}
+		} catch (...) {
+			for (Node *i : nodes) {
+				if (i)
+					A::destroy(i);
+			}
+			throw;
+		}
+
+		size_t redDepth = 0;
+		while ((size_t)2 << redDepth <= nodes.size())
+			++redDepth;
+		Node *root = _build(nodes.data(), nodes.size(), nullptr, 0, redDepth);
+
+		LockGuard<L> lg(_lock);
+		_destroy(_root);
+		_root = root;
+		_cachedMinNode = nodes.empty() ? nullptr : nodes.front();
+		_cachedMaxNode = nodes.empty() ? nullptr : nodes.back();
+		_nNodes = nodes.size();
+	}
+
+	template <typename U>
+	inline bool has(const U &key) {
+		SharedLockGuard<L> lg(_lock);
+		return _get(key) != nullptr;
 	}
 
 	inline void verify() {
-		LockGuard<Mutex> lg(_mutex);
+		SharedLockGuard<L> lg(_lock);
+		if (_cachedMinNode != _getMinNode(_root) || _cachedMaxNode != _getMaxNode(_root))
+			throw std::logic_error("Stale minimum or maximum node");
 		if (!_root)
 			return;
 
@@ -544,8 +873,8 @@ public:
 	}
 
 	inline void clear() {
-		LockGuard<Mutex> lg(_mutex);
-		delete _root;
+		LockGuard<L> lg(_lock);
+		_destroy(_root);
 		_root = nullptr;
 		_cachedMinNode = nullptr, _cachedMaxNode = nullptr;
 		_nNodes = 0;
@@ -554,6 +883,95 @@ public:
 	inline size_t size() const {
 		return _nNodes;
 	}
+
+	/// @brief The smallest value, in O(1).
+	inline T &front() {
+		SharedLockGuard<L> lg(_lock);
+		if (!_cachedMinNode)
+			throw std::logic_error("Accessing an empty tree");
+		return _cachedMinNode->value;
+	}
+
+	/// @brief The largest value, in O(1).
+	inline T &back() {
+		SharedLockGuard<L> lg(_lock);
+		if (!_cachedMaxNode)
+			throw std::logic_error("Accessing an empty tree");
+		return _cachedMaxNode->value;
+	}
+
+	/// @brief Remove and return the smallest value, so that the tree can
+	/// serve as a priority queue.
+	inline T popFront() {
+		LockGuard<L> lg(_lock);
+		if (!_cachedMinNode)
+			throw std::logic_error("Popping from an empty tree");
+
+		T value = std::move(_cachedMinNode->value);
+		_remove(_cachedMinNode);
+		return value;
+	}
+
+	/// @brief Remove and return the largest value.
+	inline T popBack() {
+		LockGuard<L> lg(_lock);
+		if (!_cachedMaxNode)
+			throw std::logic_error("Popping from an empty tree");
+
+		T value = std::move(_cachedMaxNode->value);
+		_remove(_cachedMaxNode);
+		return value;
+	}
+
+	/// @brief The k-th smallest value, counting from 0.
+	/// @return The end iterator if k is not less than size().
+	inline Iterator select(size_t k) {
+		static_assert(RANKED, "select() needs a ranked tree");
+		SharedLockGuard<L> lg(_lock);
+
+		Node *i = _root;
+		while (i) {
+			size_t nLeft = _size(i->l);
+			if (k < nLeft)
+				i = i->l;
+			else if (k > nLeft) {
+				k -= nLeft + 1;
+				i = i->r;
+			} else
+				break;
+		}
+		return Iterator(i, this);
+	}
+
+	/// @brief Number of values less than `key`.
+	template <typename U>
+	inline size_t rank(const U &key) {
+		static_assert(RANKED, "rank() needs a ranked tree");
+		SharedLockGuard<L> lg(_lock);
+		return _rank(key);
+	}
+
+	/// @brief Number of values in [lo, hi).
+	template <typename U, typename W>
+	inline size_t countRange(const U &lo, const W &hi) {
+		static_assert(RANKED, "countRange() needs a ranked tree");
+		SharedLockGuard<L> lg(_lock);
+
+		size_t nLo = _rank(lo), nHi = _rank(hi);
+		return nHi > nLo ? nHi - nLo : 0;
+	}
+
+	/// @brief Hold off writers, e.g. for the duration of an iteration.
+	/// Any number of readers may hold the tree at the same time. With
+	/// RWLock, lookups may be nested inside, see RWLock. With the exclusive
+	/// policies (SpinLock, Mutex) they deadlock and must not be.
+	inline void lockShared() {
+		_lock.lockShared();
+	}
+
+	inline void unlockShared() {
+		_lock.unlockShared();
+	}
 };
 
 #endif
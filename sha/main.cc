@@ -1,37 +1,141 @@
 #include <cstdint>
 #include <cstdio>
-#include <cfloat>
-
-constexpr uint32_t K[64] = {
-	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-};
-
-constexpr uint32_t H[8] = {
-	0x6a09e667,
-	0xbb67ae85,
-	0x3c6ef372,
-	0xa54ff53a,
-	0x510e527f,
-	0x9b05688c,
-	0x1f83d9ab,
-	0x5be0cd19,
-};
-
-void sha256(char *dest, const char *data, size_t size) {
-	auto lenDiff = size & 511;
-	if (lenDiff > 448) {
-		lenDiff = 960 - lenDiff;
-	} else if (lenDiff < 448) {
-		lenDiff = 448 - lenDiff;
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include "sha256.hh"
+
+static std::string toHex(const uint8_t *digest) {
+	static const char digits[] = "0123456789abcdef";
+	std::string s;
+	for (size_t i = 0; i < Sha256::DIGEST_SIZE; ++i) {
+		s += digits[digest[i] >> 4];
+		s += digits[digest[i] & 0xf];
+	}
+	return s;
+}
+
+static std::string hash(Sha256::Kernel kernel, const void *data, size_t size) {
+	uint8_t digest[Sha256::DIGEST_SIZE];
+	Sha256 ctx(kernel);
+	ctx.update(data, size);
+	ctx.finalize(digest);
+	return toHex(digest);
+}
+
+static double throughput(Sha256::Kernel kernel, const std::vector<uint8_t> &data, int nRounds) {
+	uint8_t digest[Sha256::DIGEST_SIZE];
+	auto begin = std::chrono::steady_clock::now();
+	for (int i = 0; i < nRounds; ++i) {
+		Sha256 ctx(kernel);
+		ctx.update(data.data(), data.size());
+		ctx.finalize(digest);
 	}
+	auto end = std::chrono::steady_clock::now();
+	return data.size() * (double)nRounds / std::chrono::duration<double>(end - begin).count() / 1e9;
 }
 
 int main() {
+	static const struct {
+		const char *message, *digest;
+	} vectors[] = {
+		{ "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+		{ "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+		{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+		{ "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" },
+	};
+	const Sha256::Kernel kernels[] = { Sha256::Kernel::SCALAR, Sha256::Kernel::SHANI };
+	const char *kernelNames[] = { "scalar", "sha-ni" };
+	int nFailures = 0;
+
+	for (int i = 0; i < 2; ++i) {
+		if (!Sha256::isSupported(kernels[i])) {
+			printf("%s: not supported\n", kernelNames[i]);
+			continue;
+		}
+
+		for (auto &j : vectors) {
+			std::string digest = hash(kernels[i], j.message, strlen(j.message));
+			bool ok = digest == j.digest;
+			nFailures += !ok;
+			printf("%s: \"%.16s\" = %s %s\n", kernelNames[i], j.message, digest.c_str(), ok ? "OK" : "FAILED");
+		}
+
+		// One million 'a', fed in odd-sized pieces.
+		Sha256 ctx(kernels[i]);
+		std::string piece(997, 'a');
+		size_t left = 1000000;
+		while (left) {
+			size_t n = std::min(left, piece.size());
+			ctx.update(piece.data(), n);
+			left -= n;
+		}
+		uint8_t digest[Sha256::DIGEST_SIZE];
+		ctx.finalize(digest);
+		bool ok = toHex(digest) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0";
+		nFailures += !ok;
+		printf("%s: 1M * 'a' = %s %s\n", kernelNames[i], toHex(digest).c_str(), ok ? "OK" : "FAILED");
+	}
+
+	// Cross-check the multi-buffer kernel on messages of mixed lengths.
+	std::mt19937 rng(0);
+	for (int i = 0; i < 200; ++i) {
+		std::vector<uint8_t> messages[8];
+		uint8_t digests[8][Sha256::DIGEST_SIZE];
+		uint8_t *dests[8];
+		const void *data[8];
+		size_t sizes[8];
+
+		for (int j = 0; j < 8; ++j) {
+			messages[j].resize(rng() % 300);
+			for (auto &k : messages[j])
+				k = (uint8_t)rng();
+			dests[j] = digests[j];
+			data[j] = messages[j].data();
+			sizes[j] = messages[j].size();
+		}
+
+		sha256x8(dests, data, sizes);
+
+		for (int j = 0; j < 8; ++j) {
+			if (toHex(digests[j]) != hash(Sha256::Kernel::SCALAR, data[j], sizes[j])) {
+				printf("x8: lane %d of %zu bytes FAILED\n", j, sizes[j]);
+				++nFailures;
+			}
+		}
+	}
+	printf("x8 (%s): cross-checked against scalar\n", sha256x8IsVectorized() ? "avx2" : "serial");
+
+	std::vector<uint8_t> data(1 << 20);
+	for (auto &i : data)
+		i = (uint8_t)rng();
+
+	for (int i = 0; i < 2; ++i) {
+		if (Sha256::isSupported(kernels[i]))
+			printf("%s: %.3f GB/s\n", kernelNames[i], throughput(kernels[i], data, 64));
+	}
+
+	{
+		const size_t size = data.size() / 8;
+		uint8_t digests[8][Sha256::DIGEST_SIZE];
+		uint8_t *dests[8];
+		const void *parts[8];
+		size_t sizes[8];
+		for (int i = 0; i < 8; ++i) {
+			dests[i] = digests[i];
+			parts[i] = data.data() + i * size;
+			sizes[i] = size;
+		}
+
+		const int nRounds = 64;
+		auto begin = std::chrono::steady_clock::now();
+		for (int i = 0; i < nRounds; ++i)
+			sha256x8(dests, parts, sizes);
+		auto end = std::chrono::steady_clock::now();
+		printf("x8: %.3f GB/s\n", data.size() * (double)nRounds / std::chrono::duration<double>(end - begin).count() / 1e9);
+	}
+
+	return nFailures ? 1 : 0;
 }
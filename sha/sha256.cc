@@ -0,0 +1,379 @@
+#include "sha256.hh"
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define SHA256_X86 1
+	#include <immintrin.h>
+#endif
+
+alignas(16) constexpr uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+constexpr uint32_t H[8] = {
+	0x6a09e667,
+	0xbb67ae85,
+	0x3c6ef372,
+	0xa54ff53a,
+	0x510e527f,
+	0x9b05688c,
+	0x1f83d9ab,
+	0x5be0cd19,
+};
+
+static inline uint32_t loadBe32(const uint8_t *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void storeBe32(uint8_t *p, uint32_t x) {
+	p[0] = (uint8_t)(x >> 24);
+	p[1] = (uint8_t)(x >> 16);
+	p[2] = (uint8_t)(x >> 8);
+	p[3] = (uint8_t)x;
+}
+
+static inline uint32_t rotr(uint32_t x, int n) {
+	return (x >> n) | (x << (32 - n));
+}
+
+/// @brief Write the padding of a message whose last `rem` bytes did not fill
+/// a block, i.e. 0x80, zeros and the bit length, into `tail`.
+/// @return Number of blocks in `tail`, 1 or 2.
+static size_t pad(uint8_t *tail, const uint8_t *rest, size_t rem, uint64_t length) {
+	size_t nBlocks = rem + 9 <= Sha256::BLOCK_SIZE ? 1 : 2;
+
+	memset(tail, 0, nBlocks * Sha256::BLOCK_SIZE);
+	if (rem)
+		memcpy(tail, rest, rem);
+	tail[rem] = 0x80;
+
+	uint64_t nBits = length * 8;
+	uint8_t *end = tail + nBlocks * Sha256::BLOCK_SIZE;
+	storeBe32(end - 8, (uint32_t)(nBits >> 32));
+	storeBe32(end - 4, (uint32_t)nBits);
+
+	return nBlocks;
+}
+
+static void blocksScalar(uint32_t *state, const uint8_t *blocks, size_t nBlocks) {
+	for (; nBlocks--; blocks += Sha256::BLOCK_SIZE) {
+		uint32_t w[64];
+
+		for (int i = 0; i < 16; ++i)
+			w[i] = loadBe32(blocks + i * 4);
+		for (int i = 16; i < 64; ++i) {
+			uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3],
+				 e = state[4], f = state[5], g = state[6], h = state[7];
+
+		for (int i = 0; i < 64; ++i) {
+			uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+			uint32_t ch = (e & f) ^ (~e & g);
+			uint32_t t1 = h + s1 + ch + K[i] + w[i];
+			uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+			uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+			uint32_t t2 = s0 + maj;
+
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+#ifdef SHA256_X86
+__attribute__((target("sha,sse4.1,ssse3"))) static void blocksShaNi(uint32_t *state, const uint8_t *blocks, size_t nBlocks) {
+	const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+
+	// The SHA instructions keep the state as ABEF and CDGH.
+	__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0xb1);		   // CDAB
+	__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(state + 4)), 0x1b);  // EFGH
+	__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);										   // ABEF
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);											   // CDGH
+
+	for (; nBlocks--; blocks += Sha256::BLOCK_SIZE) {
+		__m128i abefSaved = state0, cdghSaved = state1, msg, m[4];
+
+		// Each step does 4 rounds and advances the message schedule, which
+		// is kept in a ring of 4 registers of 4 words each.
+		for (int i = 0; i < 16; ++i) {
+			if (i < 4)
+				m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(blocks + i * 16)), byteSwap);
+
+			__m128i cur = m[i & 3];
+			msg = _mm_add_epi32(cur, _mm_load_si128((const __m128i *)(K + i * 4)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+
+			if (i >= 3 && i < 15) {
+				__m128i &next = m[(i + 1) & 3];
+				next = _mm_add_epi32(next, _mm_alignr_epi8(cur, m[(i + 3) & 3], 4));
+				next = _mm_sha256msg2_epu32(next, cur);
+			}
+
+			msg = _mm_shuffle_epi32(msg, 0x0e);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+			if (i >= 1 && i < 13)
+				m[(i + 3) & 3] = _mm_sha256msg1_epu32(m[(i + 3) & 3], cur);
+		}
+
+		state0 = _mm_add_epi32(state0, abefSaved);
+		state1 = _mm_add_epi32(state1, cdghSaved);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);		   // FEBA
+	state1 = _mm_shuffle_epi32(state1, 0xb1);	   // DCHG
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);   // DCBA
+	state1 = _mm_alignr_epi8(state1, tmp, 8);	   // ABEF
+
+	_mm_storeu_si128((__m128i *)state, state0);
+	_mm_storeu_si128((__m128i *)(state + 4), state1);
+}
+#endif
+
+Sha256::Sha256(Kernel kernel) : _blockFn(blockFn(kernel)) {
+	init();
+}
+
+void Sha256::init() {
+	memcpy(_state, H, sizeof(_state));
+	_bufferLen = 0;
+	_length = 0;
+}
+
+void Sha256::update(const void *data, size_t size) {
+	const uint8_t *p = (const uint8_t *)data;
+	_length += size;
+
+	if (_bufferLen) {
+		size_t n = std::min(size, BLOCK_SIZE - _bufferLen);
+		memcpy(_buffer + _bufferLen, p, n);
+		_bufferLen += n, p += n, size -= n;
+
+		if (_bufferLen < BLOCK_SIZE)
+			return;
+		_blockFn(_state, _buffer, 1);
+		_bufferLen = 0;
+	}
+
+	size_t nBlocks = size / BLOCK_SIZE;
+	if (nBlocks) {
+		_blockFn(_state, p, nBlocks);
+		p += nBlocks * BLOCK_SIZE, size -= nBlocks * BLOCK_SIZE;
+	}
+
+	if (size)
+		memcpy(_buffer, p, size);
+	_bufferLen = size;
+}
+
+void Sha256::finalize(uint8_t *digest) {
+	uint8_t tail[BLOCK_SIZE * 2];
+	size_t nBlocks = pad(tail, _buffer, _bufferLen, _length);
+	_blockFn(_state, tail, nBlocks);
+
+	for (int i = 0; i < 8; ++i)
+		storeBe32(digest + i * 4, _state[i]);
+
+	init();
+}
+
+bool Sha256::isSupported(Kernel kernel) {
+	switch (kernel) {
+		case Kernel::SCALAR:
+			return true;
+		case Kernel::SHANI:
+#ifdef SHA256_X86
+			return __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+#else
+			return false;
+#endif
+	}
+	return false;
+}
+
+Sha256::Kernel Sha256::bestKernel() {
+	static const Kernel kernel = isSupported(Kernel::SHANI) ? Kernel::SHANI : Kernel::SCALAR;
+	return kernel;
+}
+
+Sha256::BlockFn Sha256::blockFn(Kernel kernel) {
+#ifdef SHA256_X86
+	if (kernel == Kernel::SHANI && isSupported(Kernel::SHANI))
+		return blocksShaNi;
+#endif
+	return blocksScalar;
+}
+
+void sha256(uint8_t *dest, const void *data, size_t size) {
+	Sha256 ctx;
+	ctx.update(data, size);
+	ctx.finalize(dest);
+}
+
+#ifdef SHA256_X86
+	#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i rotr8x(__m256i x, int n) {
+	return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+/// @brief Load 8 words from each of 8 blocks, transposed so that vector `i`
+/// holds word `i` of every lane, and convert them from big endian.
+AVX2 static inline void loadTransposed(__m256i *w, const uint8_t *const blocks[8], size_t offset) {
+	const __m256i byteSwap = _mm256_set_epi8(
+		12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+		12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	__m256i r[8], t[8], u[8];
+
+	for (int i = 0; i < 8; ++i)
+		r[i] = _mm256_loadu_si256((const __m256i *)(blocks[i] + offset));
+
+	for (int i = 0; i < 8; i += 2) {
+		t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+		t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+	}
+	for (int i = 0; i < 8; i += 4) {
+		u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+		u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+		u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+		u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+	}
+	for (int i = 0; i < 4; ++i) {
+		w[i] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[i], u[i + 4], 0x20), byteSwap);
+		w[i + 4] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[i], u[i + 4], 0x31), byteSwap);
+	}
+}
+
+/// @brief Compress one block of each of 8 messages, lanes whose bit is
+/// clear in `active` keep their state.
+AVX2 static void blockX8Avx2(__m256i *state, const uint8_t *const blocks[8], __m256i active) {
+	__m256i w[64];
+
+	loadTransposed(w, blocks, 0);
+	loadTransposed(w + 8, blocks, 32);
+
+	for (int i = 16; i < 64; ++i) {
+		__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr8x(w[i - 15], 7), rotr8x(w[i - 15], 18)), _mm256_srli_epi32(w[i - 15], 3));
+		__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr8x(w[i - 2], 17), rotr8x(w[i - 2], 19)), _mm256_srli_epi32(w[i - 2], 10));
+		w[i] = _mm256_add_epi32(_mm256_add_epi32(w[i - 16], s0), _mm256_add_epi32(w[i - 7], s1));
+	}
+
+	__m256i a = state[0], b = state[1], c = state[2], d = state[3],
+			e = state[4], f = state[5], g = state[6], h = state[7];
+
+	for (int i = 0; i < 64; ++i) {
+		__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr8x(e, 6), rotr8x(e, 11)), rotr8x(e, 25));
+		__m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+		__m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, s1), _mm256_add_epi32(ch, _mm256_add_epi32(_mm256_set1_epi32(K[i]), w[i])));
+		__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr8x(a, 2), rotr8x(a, 13)), rotr8x(a, 22));
+		__m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+		__m256i t2 = _mm256_add_epi32(s0, maj);
+
+		h = g;
+		g = f;
+		f = e;
+		e = _mm256_add_epi32(d, t1);
+		d = c;
+		c = b;
+		b = a;
+		a = _mm256_add_epi32(t1, t2);
+	}
+
+	__m256i result[8] = { a, b, c, d, e, f, g, h };
+	for (int i = 0; i < 8; ++i)
+		state[i] = _mm256_blendv_epi8(state[i], _mm256_add_epi32(state[i], result[i]), active);
+}
+
+AVX2 static void sha256x8Avx2(uint8_t *const dests[8], const void *const data[8], const size_t sizes[8]) {
+	static const uint8_t idleBlock[Sha256::BLOCK_SIZE] = {};
+	uint8_t tails[8][Sha256::BLOCK_SIZE * 2];
+	size_t nFullBlocks[8], nBlocks[8], maxBlocks = 0;
+
+	for (int i = 0; i < 8; ++i) {
+		nFullBlocks[i] = sizes[i] / Sha256::BLOCK_SIZE;
+		nBlocks[i] = nFullBlocks[i] + pad(tails[i],
+										  (const uint8_t *)data[i] + nFullBlocks[i] * Sha256::BLOCK_SIZE,
+										  sizes[i] % Sha256::BLOCK_SIZE,
+										  sizes[i]);
+		maxBlocks = std::max(maxBlocks, nBlocks[i]);
+	}
+
+	__m256i state[8];
+	for (int i = 0; i < 8; ++i)
+		state[i] = _mm256_set1_epi32(H[i]);
+
+	for (size_t i = 0; i < maxBlocks; ++i) {
+		const uint8_t *blocks[8];
+		alignas(32) int32_t active[8];
+
+		// Lanes which ran out of blocks are fed a dummy block and masked out.
+		for (int j = 0; j < 8; ++j) {
+			if (i < nFullBlocks[j])
+				blocks[j] = (const uint8_t *)data[j] + i * Sha256::BLOCK_SIZE;
+			else if (i < nBlocks[j])
+				blocks[j] = tails[j] + (i - nFullBlocks[j]) * Sha256::BLOCK_SIZE;
+			else
+				blocks[j] = idleBlock;
+			active[j] = i < nBlocks[j] ? -1 : 0;
+		}
+
+		blockX8Avx2(state, blocks, _mm256_load_si256((const __m256i *)active));
+	}
+
+	for (int i = 0; i < 8; ++i) {
+		alignas(32) uint32_t words[8];
+		_mm256_store_si256((__m256i *)words, state[i]);
+		for (int j = 0; j < 8; ++j)
+			storeBe32(dests[j] + i * 4, words[j]);
+	}
+}
+
+	#undef AVX2
+#endif
+
+bool sha256x8IsVectorized() {
+#ifdef SHA256_X86
+	static const bool supported = __builtin_cpu_supports("avx2");
+	return supported;
+#else
+	return false;
+#endif
+}
+
+void sha256x8(uint8_t *const dests[8], const void *const data[8], const size_t sizes[8]) {
+#ifdef SHA256_X86
+	if (sha256x8IsVectorized()) {
+		sha256x8Avx2(dests, data, sizes);
+		return;
+	}
+#endif
+	for (int i = 0; i < 8; ++i)
+		sha256(dests[i], data[i], sizes[i]);
+}
@@ -0,0 +1,50 @@
+#ifndef __SHA256_HH__
+#define __SHA256_HH__
+
+#include <cstdint>
+#include <cstddef>
+
+/// @brief Streaming SHA-256.
+///
+/// The block function is picked at runtime: SHA-NI when the CPU has it and a
+/// portable scalar implementation otherwise.
+class Sha256 {
+public:
+	constexpr static size_t BLOCK_SIZE = 64, DIGEST_SIZE = 32;
+
+	enum class Kernel {
+		SCALAR,
+		SHANI
+	};
+
+	using BlockFn = void (*)(uint32_t *state, const uint8_t *blocks, size_t nBlocks);
+
+private:
+	uint32_t _state[8];
+	uint8_t _buffer[BLOCK_SIZE];
+	size_t _bufferLen;
+	uint64_t _length;
+	BlockFn _blockFn;
+
+public:
+	Sha256(Kernel kernel = bestKernel());
+
+	void init();
+	void update(const void *data, size_t size);
+	void finalize(uint8_t *digest);
+
+	static bool isSupported(Kernel kernel);
+	static Kernel bestKernel();
+	static BlockFn blockFn(Kernel kernel);
+};
+
+void sha256(uint8_t *dest, const void *data, size_t size);
+
+/// @brief Whether sha256x8() runs on the AVX2 multi-buffer kernel, it falls
+/// back to hashing the messages one by one otherwise.
+bool sha256x8IsVectorized();
+
+/// @brief Hash 8 independent messages of arbitrary lengths at once.
+void sha256x8(uint8_t *const dests[8], const void *const data[8], const size_t sizes[8]);
+
+#endif
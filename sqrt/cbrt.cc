@@ -0,0 +1,304 @@
+#include "cbrt.hh"
+#include <cmath>
+#include <cfloat>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define CBRT_X86 1
+	#include <immintrin.h>
+#endif
+
+// Dividing the upper word of a double by 3 and adding this bias gives a
+// cube root estimate within about 3.2% (same constant as in fdlibm's cbrt).
+constexpr uint32_t CBRT_BIAS = 715094163;
+
+static inline double estimate(double ax) {
+	uint64_t bits;
+	memcpy(&bits, &ax, sizeof(bits));
+	bits = (uint64_t)((uint32_t)(bits >> 32) / 3 + CBRT_BIAS) << 32;
+
+	double y;
+	memcpy(&y, &bits, sizeof(y));
+	return y;
+}
+
+// Halley's method for y^3 = a, cubic convergence. y^3/a is formed as
+// (y*y/a)*y so that it does not overflow near DBL_MAX.
+static inline double halley(double y, double a) {
+	double r = y * y / a * y;
+	return y * (r + 2) / (r + r + 1);
+}
+
+// Newton's method for y^3 = a, used as the last step since its rounding
+// error is the smallest.
+static inline double newton(double y, double a) {
+	return y + (a / (y * y) - y) * (1.0 / 3);
+}
+
+static double cbrtScalar(double x) {
+	double ax = fabs(x);
+
+	if (!(ax >= DBL_MIN) || ax > DBL_MAX) {
+		// Zeros, infinities and NaNs.
+		if (ax == 0 || !(ax <= DBL_MAX))
+			return x + x;
+		// Subnormals, scale them into the normal range: cbrt(2^54) = 2^18.
+		return cbrtScalar(x * 0x1p54) * 0x1p-18;
+	}
+
+	double y = estimate(ax);
+	y = halley(y, ax);
+	y = halley(y, ax);
+	y = newton(y, ax);
+	return copysign(y, x);
+}
+
+// Floats are computed in double, where even float subnormals are normal.
+static float cbrtScalar(float x) {
+	double ax = fabs((double)x);
+
+	if (ax == 0 || !(ax <= DBL_MAX))
+		return x + x;
+
+	double y = estimate(ax);
+	y = halley(y, ax);
+	y = newton(y, ax);
+	return (float)copysign(y, (double)x);
+}
+
+template <typename T>
+static void cbrtBatchScalar(T *dest, const T *src, size_t n) {
+	for (size_t i = 0; i < n; ++i)
+		dest[i] = cbrtScalar(src[i]);
+}
+
+#ifdef CBRT_X86
+	#pragma GCC push_options
+	#pragma GCC target("avx2")
+
+static inline __m256d estimate4(__m256d ax) {
+	// x / 3 == (x * 0xaaaaaaab) >> 33 for any 32-bit x.
+	__m256i hi = _mm256_srli_epi64(_mm256_castpd_si256(ax), 32);
+	__m256i q = _mm256_srli_epi64(_mm256_mul_epu32(hi, _mm256_set1_epi64x(0xaaaaaaab)), 33);
+	return _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(q, _mm256_set1_epi64x(CBRT_BIAS)), 32));
+}
+
+static inline __m256d halley4(__m256d y, __m256d a) {
+	__m256d r = _mm256_mul_pd(_mm256_div_pd(_mm256_mul_pd(y, y), a), y);
+	__m256d num = _mm256_add_pd(r, _mm256_set1_pd(2));
+	__m256d den = _mm256_add_pd(_mm256_add_pd(r, r), _mm256_set1_pd(1));
+	return _mm256_div_pd(_mm256_mul_pd(y, num), den);
+}
+
+static inline __m256d newton4(__m256d y, __m256d a) {
+	__m256d d = _mm256_sub_pd(_mm256_div_pd(a, _mm256_mul_pd(y, y)), y);
+	return _mm256_add_pd(y, _mm256_mul_pd(d, _mm256_set1_pd(1.0 / 3)));
+}
+
+/// @param special Receives the lanes which have to take the scalar path.
+template <int N_HALLEY>
+static inline __m256d cbrt4(__m256d x, int &special) {
+	const __m256d signMask = _mm256_set1_pd(-0.0);
+	__m256d ax = _mm256_andnot_pd(signMask, x);
+
+	special = _mm256_movemask_pd(_mm256_or_pd(
+		_mm256_cmp_pd(ax, _mm256_set1_pd(DBL_MIN), _CMP_NGE_UQ),
+		_mm256_cmp_pd(ax, _mm256_set1_pd(DBL_MAX), _CMP_GT_OQ)));
+
+	__m256d y = estimate4(ax);
+	for (int i = 0; i < N_HALLEY; ++i)
+		y = halley4(y, ax);
+	y = newton4(y, ax);
+	return _mm256_or_pd(y, _mm256_and_pd(x, signMask));
+}
+
+static void cbrtBatchAvx2(double *dest, const double *src, size_t n) {
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		int special;
+		__m256d x = _mm256_loadu_pd(src + i);
+		__m256d y = cbrt4<2>(x, special);
+
+		if (special) {
+			double xs[4];
+			_mm256_storeu_pd(xs, x);
+			_mm256_storeu_pd(dest + i, y);
+			for (int j = 0; j < 4; ++j) {
+				if (special & (1 << j))
+					dest[i + j] = cbrtScalar(xs[j]);
+			}
+		} else
+			_mm256_storeu_pd(dest + i, y);
+	}
+	cbrtBatchScalar(dest + i, src + i, n - i);
+}
+
+static void cbrtBatchAvx2(float *dest, const float *src, size_t n) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		int specialLo, specialHi;
+		__m256 x = _mm256_loadu_ps(src + i);
+		__m256d lo = cbrt4<1>(_mm256_cvtps_pd(_mm256_castps256_ps128(x)), specialLo);
+		__m256d hi = cbrt4<1>(_mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)), specialHi);
+		__m256 y = _mm256_set_m128(_mm256_cvtpd_ps(hi), _mm256_cvtpd_ps(lo));
+		int special = specialLo | (specialHi << 4);
+
+		if (special) {
+			float xs[8];
+			_mm256_storeu_ps(xs, x);
+			_mm256_storeu_ps(dest + i, y);
+			for (int j = 0; j < 8; ++j) {
+				if (special & (1 << j))
+					dest[i + j] = cbrtScalar(xs[j]);
+			}
+		} else
+			_mm256_storeu_ps(dest + i, y);
+	}
+	cbrtBatchScalar(dest + i, src + i, n - i);
+}
+
+	#pragma GCC pop_options
+
+	#pragma GCC push_options
+	#pragma GCC target("avx512f")
+	// GCC's unmasked AVX-512 intrinsics start from an undefined vector,
+	// which -Wmaybe-uninitialized wrongly reports.
+	#pragma GCC diagnostic push
+	#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+static inline __m512d estimate8(__m512d ax) {
+	__m512i hi = _mm512_srli_epi64(_mm512_castpd_si512(ax), 32);
+	__m512i q = _mm512_srli_epi64(_mm512_mul_epu32(hi, _mm512_set1_epi64(0xaaaaaaab)), 33);
+	return _mm512_castsi512_pd(_mm512_slli_epi64(_mm512_add_epi64(q, _mm512_set1_epi64(CBRT_BIAS)), 32));
+}
+
+static inline __m512d halley8(__m512d y, __m512d a) {
+	__m512d r = _mm512_mul_pd(_mm512_div_pd(_mm512_mul_pd(y, y), a), y);
+	__m512d num = _mm512_add_pd(r, _mm512_set1_pd(2));
+	__m512d den = _mm512_add_pd(_mm512_add_pd(r, r), _mm512_set1_pd(1));
+	return _mm512_div_pd(_mm512_mul_pd(y, num), den);
+}
+
+static inline __m512d newton8(__m512d y, __m512d a) {
+	__m512d d = _mm512_sub_pd(_mm512_div_pd(a, _mm512_mul_pd(y, y)), y);
+	return _mm512_add_pd(y, _mm512_mul_pd(d, _mm512_set1_pd(1.0 / 3)));
+}
+
+template <int N_HALLEY>
+static inline __m512d cbrt8(__m512d x, int &special) {
+	const __m512i signMask = _mm512_set1_epi64(INT64_MIN);
+	__m512i xi = _mm512_castpd_si512(x);
+	__m512d ax = _mm512_castsi512_pd(_mm512_andnot_si512(signMask, xi));
+
+	special = _mm512_cmp_pd_mask(ax, _mm512_set1_pd(DBL_MIN), _CMP_NGE_UQ) |
+			  _mm512_cmp_pd_mask(ax, _mm512_set1_pd(DBL_MAX), _CMP_GT_OQ);
+
+	__m512d y = estimate8(ax);
+	for (int i = 0; i < N_HALLEY; ++i)
+		y = halley8(y, ax);
+	y = newton8(y, ax);
+	return _mm512_castsi512_pd(_mm512_or_si512(_mm512_castpd_si512(y), _mm512_and_si512(xi, signMask)));
+}
+
+static void cbrtBatchAvx512(double *dest, const double *src, size_t n) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		int special;
+		__m512d x = _mm512_loadu_pd(src + i);
+		__m512d y = cbrt8<2>(x, special);
+
+		if (special) {
+			double xs[8];
+			_mm512_storeu_pd(xs, x);
+			_mm512_storeu_pd(dest + i, y);
+			for (int j = 0; j < 8; ++j) {
+				if (special & (1 << j))
+					dest[i + j] = cbrtScalar(xs[j]);
+			}
+		} else
+			_mm512_storeu_pd(dest + i, y);
+	}
+	cbrtBatchScalar(dest + i, src + i, n - i);
+}
+
+static void cbrtBatchAvx512(float *dest, const float *src, size_t n) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		int specialLo, specialHi;
+		__m512 x = _mm512_loadu_ps(src + i);
+		__m256 xLo = _mm512_castps512_ps256(x);
+		__m256 xHi = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(x), 1));
+		__m256 lo = _mm512_cvtpd_ps(cbrt8<1>(_mm512_cvtps_pd(xLo), specialLo));
+		__m256 hi = _mm512_cvtpd_ps(cbrt8<1>(_mm512_cvtps_pd(xHi), specialHi));
+		__m512 y = _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(lo)), _mm256_castps_pd(hi), 1));
+		int special = specialLo | (specialHi << 8);
+
+		if (special) {
+			float xs[16];
+			_mm512_storeu_ps(xs, x);
+			_mm512_storeu_ps(dest + i, y);
+			for (int j = 0; j < 16; ++j) {
+				if (special & (1 << j))
+					dest[i + j] = cbrtScalar(xs[j]);
+			}
+		} else
+			_mm512_storeu_ps(dest + i, y);
+	}
+	cbrtBatchScalar(dest + i, src + i, n - i);
+}
+
+	#pragma GCC diagnostic pop
+	#pragma GCC pop_options
+#endif
+
+bool cbrtIsSupported(CbrtKernel kernel) {
+	switch (kernel) {
+		case CbrtKernel::SCALAR:
+			return true;
+#ifdef CBRT_X86
+		case CbrtKernel::AVX2:
+			return __builtin_cpu_supports("avx2");
+		case CbrtKernel::AVX512:
+			return __builtin_cpu_supports("avx512f");
+#else
+		default:
+			return false;
+#endif
+	}
+	return false;
+}
+
+CbrtKernel cbrtBestKernel() {
+	static const CbrtKernel kernel = cbrtIsSupported(CbrtKernel::AVX512) ? CbrtKernel::AVX512
+									 : cbrtIsSupported(CbrtKernel::AVX2)  ? CbrtKernel::AVX2
+																		  : CbrtKernel::SCALAR;
+	return kernel;
+}
+
+template <typename T>
+static inline void cbrtDispatch(T *dest, const T *src, size_t n, CbrtKernel kernel) {
+	if (!cbrtIsSupported(kernel))
+		kernel = CbrtKernel::SCALAR;
+
+	switch (kernel) {
+#ifdef CBRT_X86
+		case CbrtKernel::AVX512:
+			cbrtBatchAvx512(dest, src, n);
+			break;
+		case CbrtKernel::AVX2:
+			cbrtBatchAvx2(dest, src, n);
+			break;
+#endif
+		default:
+			cbrtBatchScalar(dest, src, n);
+	}
+}
+
+void cbrtBatch(double *dest, const double *src, size_t n, CbrtKernel kernel) {
+	cbrtDispatch(dest, src, n, kernel);
+}
+
+void cbrtBatch(float *dest, const float *src, size_t n, CbrtKernel kernel) {
+	cbrtDispatch(dest, src, n, kernel);
+}
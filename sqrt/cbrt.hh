@@ -0,0 +1,23 @@
+#ifndef __CBRT_HH__
+#define __CBRT_HH__
+
+#include <cstddef>
+
+/// @brief Kernels of the batch cube root, the scalar one is always available.
+enum class CbrtKernel {
+	SCALAR,
+	AVX2,
+	AVX512
+};
+
+bool cbrtIsSupported(CbrtKernel kernel);
+CbrtKernel cbrtBestKernel();
+
+/// @brief Cube roots of `n` values, `dest` may alias `src`.
+///
+/// A bit-trick estimate is refined with two Halley steps and a final Newton
+/// step for doubles, or one of each for floats, which stays within 1 ULP.
+void cbrtBatch(double *dest, const double *src, size_t n, CbrtKernel kernel = cbrtBestKernel());
+void cbrtBatch(float *dest, const float *src, size_t n, CbrtKernel kernel = cbrtBestKernel());
+
+#endif
@@ -1,8 +1,14 @@
 #include <cstdio>
 #include <cmath>
 #include <cstdint>
-#include <ratio>
-#include <immintrin.h>
+#include <cstring>
+#include <cfloat>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include "cbrt.hh"
 
 double myCbrt(double a) {
 	double x = a, lastResult;
@@ -32,12 +38,98 @@ double myCbrt(double a) {
 	return x;
 }
 
+static const char *kernelName(CbrtKernel kernel) {
+	switch (kernel) {
+		case CbrtKernel::SCALAR:
+			return "scalar";
+		case CbrtKernel::AVX2:
+			return "avx2";
+		case CbrtKernel::AVX512:
+			return "avx512";
+	}
+	return "?";
+}
+
+/// @brief Error of `y` in ULPs of the correctly rounded result `ref`.
+template <typename T>
+static double ulpError(T y, long double ref) {
+	if (std::isnan(ref))
+		return std::isnan(y) ? 0 : INFINITY;
+	if (std::isinf(ref) || ref == 0)
+		return y == ref ? 0 : INFINITY;
+
+	int e;
+	frexpl(ref, &e);
+	e = std::max(e, std::numeric_limits<T>::min_exponent);
+	return (double)(fabsl((long double)y - ref) / ldexpl(1.0L, e - std::numeric_limits<T>::digits));
+}
+
+template <typename F>
+static double seconds(F &&f) {
+	auto begin = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+/// @brief Random values over the whole range of T, including subnormals
+/// and a sprinkling of zeros, infinities and NaNs.
+template <typename T, typename U>
+static std::vector<T> randomValues(size_t n) {
+	std::mt19937_64 rng(1);
+	std::vector<T> values(n);
+	for (auto &i : values) {
+		U bits = (U)rng();
+		memcpy(&i, &bits, sizeof(T));
+		if (std::isnan(i) && rng() % 64)
+			i = (T)(rng() % 1000);
+	}
+	values[0] = 0, values[1] = -(T)0, values[2] = INFINITY, values[3] = -INFINITY;
+	return values;
+}
+
+template <typename T, typename U>
+static void compare(const char *typeName, T (*libmCbrt)(T)) {
+	const size_t n = 1 << 22;
+	const CbrtKernel kernels[] = { CbrtKernel::SCALAR, CbrtKernel::AVX2, CbrtKernel::AVX512 };
+	std::vector<T> src = randomValues<T, U>(n), dest(n);
+
+	double maxUlp = 0;
+	double libmTime = seconds([&]() {
+		for (size_t i = 0; i < n; ++i)
+			dest[i] = libmCbrt(src[i]);
+	});
+	for (size_t i = 0; i < n; ++i)
+		maxUlp = std::max(maxUlp, ulpError(dest[i], cbrtl(src[i])));
+	printf("%s libm:   max error = %.3f ULP, %.1f M/s\n", typeName, maxUlp, n / libmTime / 1e6);
+
+	for (auto kernel : kernels) {
+		if (!cbrtIsSupported(kernel))
+			continue;
+
+		double time = seconds([&]() { cbrtBatch(dest.data(), src.data(), n, kernel); });
+		maxUlp = 0;
+		for (size_t i = 0; i < n; ++i)
+			maxUlp = std::max(maxUlp, ulpError(dest[i], cbrtl(src[i])));
+		printf("%s %-7s max error = %.3f ULP, %.1f M/s (%.2fx libm)\n",
+			typeName, kernelName(kernel), maxUlp, n / time / 1e6, libmTime / time);
+	}
+}
+
 int main() {
-	for (double i = 1.0; i <= 360.0; i += 1.0) {
-		auto stdResult = cbrt(i);
-		auto myResult = myCbrt(i);
-		printf("i = %.3lf, std = %.3lf, myimpl = %.3lf, diff = %.19lf\n", i, stdResult, myResult, stdResult - myResult);
+	double maxDiff = 0, maxBatchDiff = 0;
+	double src[360], batch[360];
+	for (int i = 0; i < 360; ++i)
+		src[i] = i + 1.0;
+	cbrtBatch(batch, src, 360);
+
+	for (int i = 0; i < 360; ++i) {
+		maxDiff = std::max(maxDiff, fabs(cbrt(src[i]) - myCbrt(src[i])));
+		maxBatchDiff = std::max(maxBatchDiff, fabs(cbrt(src[i]) - batch[i]));
 	}
+	printf("1..360: myCbrt max diff = %.19lf, cbrtBatch max diff = %.19lf\n", maxDiff, maxBatchDiff);
+
+	compare<double, uint64_t>("double", cbrt);
+	compare<float, uint32_t>("float ", cbrtf);
 
 	return 0;
 }
@@ -21,7 +21,7 @@ static int mynode_nodecmp(const kf_rbtree_node_t *x, const kf_rbtree_node_t *y)
 
 static int mynode_keycmp(const kf_rbtree_node_t *x, const void *key) {
 	const mynode_t *_x = (const mynode_t *)x;
-	int _key = (int)key;
+	int _key = (int)(intptr_t)key;
 
 	if (_x->key > _key)
 		return 1;
@@ -37,29 +37,29 @@ static void mynode_nodecopy(kf_rbtree_node_t *dest, const kf_rbtree_node_t *src)
 	_dest->key = _src->key;
 }
 
-static void mynode_nodefree(kf_rbtree_node_t *p) {
-	free(p);
-}
-
 int main() {
 	kf_rbtree_t *tree = malloc(sizeof(kf_rbtree_t));
+	kf_rbtree_slab_t slab;
 
 	kf_rbtree_init(
 		tree,
 		mynode_nodecmp,
 		mynode_keycmp,
 		mynode_nodecopy,
-		mynode_nodefree);
+		NULL);
+
+	kf_rbtree_slab_init(&slab, sizeof(mynode_t), 0);
+	kf_rbtree_use_slab(tree, &slab);
 
 	for (int i = 0; i < 64; i++) {
 		int j = i & 1 ? i : 128 - i;
 
-		mynode_t *node = malloc(sizeof(mynode_t));
+		mynode_t *node = kf_rbtree_slab_alloc(&slab);
 		memset(node, 0, sizeof(*node));
 		node->key = j;
 
 		printf("Inserting: %d\n", j);
-		kf_rbtree_insert(tree, node);
+		kf_rbtree_insert(tree, &node->node);
 		kf_rbtree_verify(tree);
 	}
 
@@ -67,7 +67,7 @@ int main() {
 		int j = i & 1 ? i : 128 - i;
 		printf("Removing: %d\n", j);
 
-		kf_rbtree_remove(tree, kf_rbtree_find(tree, j));
+		kf_rbtree_remove(tree, kf_rbtree_find(tree, (const void *)(intptr_t)j));
 
 		for (kf_rbtree_node_t *i = kf_rbtree_begin(tree); i; i = kf_rbtree_next(i))
 			printf("%d\n", ((mynode_t *)i)->key);
@@ -0,0 +1,85 @@
+#include "slab.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+// Chunks and nodes are aligned as malloc() would align them.
+#define KF_RBTREE_SLAB_ALIGN (sizeof(max_align_t))
+#define KF_RBTREE_SLAB_ALIGNUP(n) (((n) + KF_RBTREE_SLAB_ALIGN - 1) & ~(KF_RBTREE_SLAB_ALIGN - 1))
+#define KF_RBTREE_SLAB_CHUNK_HEADER_SIZE KF_RBTREE_SLAB_ALIGNUP(sizeof(kf_rbtree_slab_chunk_t))
+
+static int kf_rbtree_slab_grow(kf_rbtree_slab_t *slab);
+
+void kf_rbtree_slab_init(kf_rbtree_slab_t *slab, size_t node_size, size_t nodes_per_chunk) {
+	if (node_size < sizeof(kf_rbtree_slab_freenode_t))
+		node_size = sizeof(kf_rbtree_slab_freenode_t);
+	node_size = KF_RBTREE_SLAB_ALIGNUP(node_size);
+
+	if (!nodes_per_chunk) {
+		nodes_per_chunk = (KF_RBTREE_SLAB_DEFAULT_CHUNK_SIZE - KF_RBTREE_SLAB_CHUNK_HEADER_SIZE) / node_size;
+		if (!nodes_per_chunk)
+			nodes_per_chunk = 1;
+	}
+
+	slab->node_size = node_size;
+	slab->nodes_per_chunk = nodes_per_chunk;
+	slab->chunks = NULL;
+	slab->free_list = NULL;
+	slab->cur = NULL;
+	slab->end = NULL;
+	slab->n_chunks = 0;
+	slab->n_nodes = 0;
+}
+
+void *kf_rbtree_slab_alloc(kf_rbtree_slab_t *slab) {
+	void *p;
+
+	if (slab->free_list) {
+		p = slab->free_list;
+		slab->free_list = slab->free_list->next;
+	} else {
+		if (slab->cur == slab->end && !kf_rbtree_slab_grow(slab))
+			return NULL;
+		p = slab->cur;
+		slab->cur += slab->node_size;
+	}
+
+	++slab->n_nodes;
+	return p;
+}
+
+void kf_rbtree_slab_free(kf_rbtree_slab_t *slab, void *p) {
+	kf_rbtree_slab_freenode_t *node = (kf_rbtree_slab_freenode_t *)p;
+
+	assert(slab->n_nodes);
+
+	node->next = slab->free_list;
+	slab->free_list = node;
+	--slab->n_nodes;
+}
+
+void kf_rbtree_slab_release(kf_rbtree_slab_t *slab) {
+	kf_rbtree_slab_chunk_t *i = slab->chunks;
+	while (i) {
+		kf_rbtree_slab_chunk_t *next = i->next;
+		free(i);
+		i = next;
+	}
+
+	kf_rbtree_slab_init(slab, slab->node_size, slab->nodes_per_chunk);
+}
+
+static int kf_rbtree_slab_grow(kf_rbtree_slab_t *slab) {
+	kf_rbtree_slab_chunk_t *chunk = malloc(
+		KF_RBTREE_SLAB_CHUNK_HEADER_SIZE + slab->node_size * slab->nodes_per_chunk);
+	if (!chunk)
+		return 0;
+
+	chunk->next = slab->chunks;
+	slab->chunks = chunk;
+	++slab->n_chunks;
+
+	slab->cur = (char *)chunk + KF_RBTREE_SLAB_CHUNK_HEADER_SIZE;
+	slab->end = slab->cur + slab->node_size * slab->nodes_per_chunk;
+	return 1;
+}
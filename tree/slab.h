@@ -0,0 +1,48 @@
+#ifndef _OICOS_KF_RBTREE_SLAB_H_
+#define _OICOS_KF_RBTREE_SLAB_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Fixed-size node allocator for structs embedding kf_rbtree_node_t.
+//
+// Nodes are carved out of large chunks, freed nodes go to a free list
+// owned by the slab and the whole slab is released chunk by chunk, without
+// visiting individual nodes.
+
+#define KF_RBTREE_SLAB_DEFAULT_CHUNK_SIZE (256 * 1024)
+
+typedef struct _kf_rbtree_slab_chunk_t {
+	struct _kf_rbtree_slab_chunk_t *next;
+} kf_rbtree_slab_chunk_t;
+
+typedef struct _kf_rbtree_slab_freenode_t {
+	struct _kf_rbtree_slab_freenode_t *next;
+} kf_rbtree_slab_freenode_t;
+
+typedef struct _kf_rbtree_slab_t {
+	size_t node_size, nodes_per_chunk;
+	kf_rbtree_slab_chunk_t *chunks;
+	kf_rbtree_slab_freenode_t *free_list;
+	// Untouched tail of the newest chunk.
+	char *cur, *end;
+	size_t n_chunks, n_nodes;
+} kf_rbtree_slab_t;
+
+// Pass 0 as nodes_per_chunk to fill chunks of KF_RBTREE_SLAB_DEFAULT_CHUNK_SIZE bytes.
+void kf_rbtree_slab_init(kf_rbtree_slab_t *slab, size_t node_size, size_t nodes_per_chunk);
+
+void *kf_rbtree_slab_alloc(kf_rbtree_slab_t *slab);
+void kf_rbtree_slab_free(kf_rbtree_slab_t *slab, void *p);
+
+// Release all chunks at once, every node allocated from the slab becomes invalid.
+void kf_rbtree_slab_release(kf_rbtree_slab_t *slab);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -15,9 +15,14 @@ void kf_rbtree_init(kf_rbtree_t *dest,
 	dest->key_cmp = key_cmp;
 	dest->node_copy = node_copy;
 	dest->node_free = node_free;
+	dest->slab = NULL;
 	dest->root = NULL;
 }
 
+void kf_rbtree_use_slab(kf_rbtree_t *tree, kf_rbtree_slab_t *slab) {
+	tree->slab = slab;
+}
+
 void kf_rbtree_insert(kf_rbtree_t *tree, kf_rbtree_node_t *node) {
 	assert(!node->l);
 	assert(!node->r);
@@ -55,7 +60,10 @@ void kf_rbtree_remove(kf_rbtree_t *tree, kf_rbtree_node_t *node) {
 	y->r = NULL;
 	y->l = NULL;
 
-	tree->node_free(y);
+	if (tree->node_free)
+		tree->node_free(y);
+	if (tree->slab)
+		kf_rbtree_slab_free(tree->slab, y);
 }
 
 kf_rbtree_node_t *kf_rbtree_find(kf_rbtree_t *tree, const void *key) {
@@ -72,9 +80,79 @@ kf_rbtree_node_t *kf_rbtree_find(kf_rbtree_t *tree, const void *key) {
 	return NULL;
 }
 
+void kf_rbtree_find_batch(kf_rbtree_t *tree, const void *const *keys, size_t n, kf_rbtree_node_t **out) {
+	kf_rbtree_node_t *nodes[KF_RBTREE_BATCH_WIDTH];
+	size_t indices[KF_RBTREE_BATCH_WIDTH], n_active = 0, next = 0;
+
+	for (; n_active < KF_RBTREE_BATCH_WIDTH && next < n; ++n_active, ++next) {
+		nodes[n_active] = tree->root;
+		indices[n_active] = next;
+	}
+
+	// Advance every descent in turn by one level. A finished descent hands
+	// its place to the next key, or to the last one in flight.
+	while (n_active) {
+		for (size_t s = 0; s < n_active;) {
+			kf_rbtree_node_t *i = nodes[s];
+			int result = 0;
+			if (i) {
+				result = tree->key_cmp(i, keys[indices[s]]);
+				if (result < 0)
+					i = i->r;
+				else if (result > 0)
+					i = i->l;
+			}
+
+			if (i && result) {
+				__builtin_prefetch(i);
+				nodes[s++] = i;
+				continue;
+			}
+
+			out[indices[s]] = i;
+			if (next < n) {
+				nodes[s] = tree->root;
+				indices[s++] = next++;
+			} else {
+				--n_active;
+				nodes[s] = nodes[n_active];
+				indices[s] = indices[n_active];
+			}
+		}
+	}
+}
+
+kf_rbtree_node_t *kf_rbtree_lower_bound(kf_rbtree_t *tree, const void *key) {
+	kf_rbtree_node_t *i = tree->root, *bound = NULL;
+	while (i) {
+		if (tree->key_cmp(i, key) < 0)
+			i = i->r;
+		else {
+			bound = i;
+			i = i->l;
+		}
+	}
+	return bound;
+}
+
+kf_rbtree_node_t *kf_rbtree_upper_bound(kf_rbtree_t *tree, const void *key) {
+	kf_rbtree_node_t *i = tree->root, *bound = NULL;
+	while (i) {
+		if (tree->key_cmp(i, key) > 0) {
+			bound = i;
+			i = i->l;
+		} else
+			i = i->r;
+	}
+	return bound;
+}
+
 void kf_rbtree_free(kf_rbtree_t *tree) {
-	if (tree->root)
+	if (tree->root && tree->node_free)
 		kf_rbtree_walknodes4free(tree, tree->root);
+	if (tree->slab)
+		kf_rbtree_slab_release(tree->slab);
+	tree->root = NULL;
 }
 
 kf_rbtree_node_t *kf_rbtree_getminleaf(kf_rbtree_node_t *node) {
@@ -373,3 +451,62 @@ kf_rbtree_node_t *kf_rbtree_next(kf_rbtree_node_t *node) {
 
 	return node;
 }
+
+kf_rbtree_node_t *kf_rbtree_prev(kf_rbtree_node_t *node) {
+	if (!node)
+		return NULL;
+
+	if (node->l) {
+		node = kf_rbtree_getmaxleaf(node->l);
+	} else {
+		while (kf_rbtree_parent(node) && (node == kf_rbtree_parent(node)->l))
+			node = kf_rbtree_parent(node);
+		node = kf_rbtree_parent(node);
+	}
+
+	return node;
+}
+
+kf_rbtree_node_t *kf_rbtree_foreach(kf_rbtree_t *tree, kf_rbtree_visitor_t visit, void *arg) {
+	kf_rbtree_node_t *stack[KF_RBTREE_MAX_HEIGHT];
+	size_t depth = 0;
+
+	for (kf_rbtree_node_t *i = tree->root; i; i = i->l)
+		stack[depth++] = i;
+
+	while (depth) {
+		kf_rbtree_node_t *node = stack[--depth];
+		if (visit(node, arg))
+			return node;
+
+		for (kf_rbtree_node_t *i = node->r; i; i = i->l) {
+			assert(depth < KF_RBTREE_MAX_HEIGHT);
+			stack[depth++] = i;
+		}
+	}
+
+	return NULL;
+}
+
+kf_rbtree_node_t *kf_rbtree_iter_begin(kf_rbtree_iter_t *iter, kf_rbtree_t *tree) {
+	iter->depth = 0;
+	for (kf_rbtree_node_t *i = tree->root; i; i = i->l)
+		iter->stack[iter->depth++] = i;
+
+	return iter->depth ? iter->stack[iter->depth - 1] : NULL;
+}
+
+kf_rbtree_node_t *kf_rbtree_iter_next(kf_rbtree_iter_t *iter) {
+	if (!iter->depth)
+		return NULL;
+
+	// The top of the stack is the current node, the ones below are the
+	// ancestors whose left subtree is being visited.
+	kf_rbtree_node_t *node = iter->stack[--iter->depth];
+	for (kf_rbtree_node_t *i = node->r; i; i = i->l) {
+		assert(iter->depth < KF_RBTREE_MAX_HEIGHT);
+		iter->stack[iter->depth++] = i;
+	}
+
+	return iter->depth ? iter->stack[iter->depth - 1] : NULL;
+}
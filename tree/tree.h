@@ -3,7 +3,9 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include "slab.h"
 
 #define KF_RBTREE_BLACK 0
 #define KF_RBTREE_RED 1
@@ -20,6 +22,10 @@
 #define kf_rbtree_isblack(n) ((!n) || (kf_rbtree_color(n) == KF_RBTREE_BLACK))
 #define kf_rbtree_isred(n) ((n) && (kf_rbtree_color(n) == KF_RBTREE_RED))
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct _kf_rbtree_node_t {
 	struct _kf_rbtree_node_t *l, *r, *p_color;
 } kf_rbtree_node_t;
@@ -36,6 +42,7 @@ typedef struct _kf_rbtree_t {
 	kf_rbtree_keycmp_t key_cmp;
 	kf_rbtree_nodecopy_t node_copy;
 	kf_rbtree_nodefree_t node_free;
+	kf_rbtree_slab_t *slab;
 } kf_rbtree_t;
 
 kf_rbtree_node_t *kf_rbtree_getminleaf(kf_rbtree_node_t *node);
@@ -44,6 +51,16 @@ kf_rbtree_node_t *kf_rbtree_getmaxleaf(kf_rbtree_node_t *node);
 void kf_rbtree_insert(kf_rbtree_t *tree, kf_rbtree_node_t *node);
 void kf_rbtree_remove(kf_rbtree_t *tree, kf_rbtree_node_t *node);
 kf_rbtree_node_t *kf_rbtree_find(kf_rbtree_t *tree, const void *key);
+// Number of lookups which kf_rbtree_find_batch() keeps in flight.
+#define KF_RBTREE_BATCH_WIDTH 16
+// Sets out[i] to kf_rbtree_find(tree, keys[i]) for n keys. The descents are
+// interleaved and prefetch the next node they visit, so that their cache
+// misses overlap, which beats a loop of kf_rbtree_find() on large trees.
+void kf_rbtree_find_batch(kf_rbtree_t *tree, const void *const *keys, size_t n, kf_rbtree_node_t **out);
+// The first node which is not less than (lower_bound) or greater than
+// (upper_bound) the key, or NULL. Scan on from there with kf_rbtree_next().
+kf_rbtree_node_t *kf_rbtree_lower_bound(kf_rbtree_t *tree, const void *key);
+kf_rbtree_node_t *kf_rbtree_upper_bound(kf_rbtree_t *tree, const void *key);
 void kf_rbtree_free(kf_rbtree_t *tree);
 
 void kf_rbtree_init(kf_rbtree_t *dest,
@@ -52,9 +69,47 @@ void kf_rbtree_init(kf_rbtree_t *dest,
 	kf_rbtree_nodecopy_t node_copy,
 	kf_rbtree_nodefree_t node_free);
 
+// Let the tree return removed nodes to a slab, which the nodes must have been
+// allocated from. node_free then only has to release resources owned by a
+// node and may be NULL, in which case kf_rbtree_free() releases the whole
+// slab at once instead of visiting every node.
+void kf_rbtree_use_slab(kf_rbtree_t *tree, kf_rbtree_slab_t *slab);
+
 void kf_rbtree_verify(kf_rbtree_t* tree);
 
-#define kf_rbtree_begin(tree) ((tree)->root ? kf_rbtree_getminleaf(tree) : NULL)
+#define kf_rbtree_begin(tree) ((tree)->root ? kf_rbtree_getminleaf((tree)->root) : NULL)
+#define kf_rbtree_rbegin(tree) ((tree)->root ? kf_rbtree_getmaxleaf((tree)->root) : NULL)
 kf_rbtree_node_t* kf_rbtree_next(kf_rbtree_node_t* node);
+kf_rbtree_node_t *kf_rbtree_prev(kf_rbtree_node_t *node);
+
+// A red-black tree with n nodes is at most 2 * log2(n + 1) high, which is
+// below this for any n that fits into memory.
+#define KF_RBTREE_MAX_HEIGHT 128
+
+// Returns nonzero to stop the traversal.
+typedef int (*kf_rbtree_visitor_t)(kf_rbtree_node_t *node, void *arg);
+
+// Visit every node in order without reading parent pointers, which is faster
+// than kf_rbtree_next() for full scans. The tree must not be modified
+// meanwhile. Returns the node the visitor stopped at, or NULL.
+kf_rbtree_node_t *kf_rbtree_foreach(kf_rbtree_t *tree, kf_rbtree_visitor_t visit, void *arg);
+
+// In-order iterator which keeps the path from the root on a stack instead of
+// climbing through parent pointers. Any modification of the tree invalidates
+// it.
+typedef struct _kf_rbtree_iter_t {
+	kf_rbtree_node_t *stack[KF_RBTREE_MAX_HEIGHT];
+	size_t depth;
+} kf_rbtree_iter_t;
+
+// Both return the current node, or NULL at the end:
+//
+//	for (kf_rbtree_node_t *i = kf_rbtree_iter_begin(&it, tree); i; i = kf_rbtree_iter_next(&it))
+kf_rbtree_node_t *kf_rbtree_iter_begin(kf_rbtree_iter_t *iter, kf_rbtree_t *tree);
+kf_rbtree_node_t *kf_rbtree_iter_next(kf_rbtree_iter_t *iter);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif